@@ -0,0 +1,48 @@
+//
+// All the defined constants and functions relevant to running many tm
+// commands in a single process
+//
+// Every line read is one tm command, written the same way as on the command
+// line, with or without the leading 'tm'. Blank lines and lines starting
+// with '#' are skipped
+//
+
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include <string>
+#include <vector>
+
+#include "database.hpp"
+
+
+namespace tm_batch {
+
+    /**
+     * Description: runs a single command inside of its own transaction, or
+     * savepoint if a transaction was already begun, so that a failed
+     * command leaves no changes behind. Commands that only read take the
+     * write lock once they write, if ever
+     * @param[in] db: the database shared by the commands
+     * @param[in] args: the arguments of the command, starting with "tm"
+     * @return the exit status of the command
+     */
+    int run_command(tm_db::TMDatabase &db,
+                    const std::vector<std::string> &args);
+
+    /**
+     * Description: runs every command read from stdin against the same
+     * database inside a single transaction. A command that fails is rolled
+     * back and reported along with its line number, and the commands after
+     * it still run
+     */
+    void handle_batch();
+
+    /**
+     * Description: returns true while handle_batch is reading commands from
+     * stdin, so that the commands it runs don't read stdin themselves
+     */
+    bool running();
+}
+
+#endif // BATCH_HPP_
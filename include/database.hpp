@@ -10,6 +10,7 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <sqlite3.h>
 
 #include "utils.hpp"
@@ -20,7 +21,25 @@
 
 #define TM_DIR "/.tm.d"
 #define DB_FILE "/data.sqlite3"
-#define SESS_LOG_FILE "/sess.log"
+#define CONFIG_FILE "/config"
+
+// The last heatmap rendered by tm stat grad, removed whenever a session is
+// added, removed or checkpointed
+#define GRAD_CACHE_FILE "/grad_cache"
+
+// The control socket of a running session is sess_<id>.sock, next to the
+// database, and the process running it holds a lock on sess_<id>.lock
+#define SESS_SOCKET_PREFIX "/sess_"
+#define SESS_SOCKET_SUFFIX ".sock"
+#define SESS_LOCK_SUFFIX ".lock"
+
+// The version of the schema that this build of tm expects, it is stored in
+// the database with PRAGMA user_version, bump it when adding a migration
+#define SCHEMA_VERSION 8
+
+// The Rata Die day number of 1970-01-01, the days stored in the database are
+// counted from the epoch, adding this gives the Rata Die of a day
+#define EPOCH_RDN 719163
 
 
 namespace tm_db {
@@ -35,6 +54,90 @@ namespace tm_db {
         std::string proj_name;
         std::string due;
         std::vector<std::string> tags;
+        int complete = 0;
+        std::string time_done;
+    };
+
+    struct Sess {
+        std::string task_name;
+        // the id of the task in the stream the session is imported from, 0
+        // if the task is referenced by task_name
+        int task_key = 0;
+        std::string time_started;
+        int length;
+        std::string desc;
+    };
+
+    // A session that hasn't ended yet, either run by a tm sess start process
+    // or detached, in which case it is only a row in open_sess
+    struct OpenSess {
+        int id;
+        int task_id;
+        // the process running the session, 0 if it is detached, and the host
+        // it runs on, empty if unknown
+        int pid;
+        std::string host;
+        long long time_started;
+        // the length of the last checkpoint, in seconds
+        int saved;
+        // the planned length, and the length at which it ends, in seconds
+        int length;
+        int max_length;
+    };
+
+    // The ids of tags, projects and tasks keyed by their names, loaded once
+    // before a bulk import so that names are resolved without a query per
+    // record. If several tasks share a name, the most recent one is kept
+    struct IdMaps {
+        std::unordered_map<std::string, int> tags;
+        std::unordered_map<std::string, int> projects;
+        std::unordered_map<std::string, int> tasks;
+        // the ids of the imported tasks, keyed by their id in the stream
+        std::unordered_map<int, int> task_keys;
+    };
+
+    // The settings applied to every connection when the database is opened.
+    // Each one can be set in ~/.tm.d/config as a "key = value" line, where
+    // the key is the name of the field, or with the TM_<FIELD> environment
+    // variable (e.g. TM_CACHE_SIZE), which takes precedence over the file.
+    // WAL lets readers like a status bar polling tm keep going while a
+    // session is being written, and only needs fsyncs on checkpoints
+    struct ConnProfile {
+        std::string journal_mode = "WAL";
+        std::string synchronous = "NORMAL";
+        std::string temp_store = "MEMORY";
+        // bytes of the database file that are memory mapped
+        long long mmap_size = 268435456;
+        // pages when positive, KiB when negative, like PRAGMA cache_size
+        long long cache_size = -16384;
+        // milliseconds to wait on a locked database before failing
+        int busy_timeout = 5000;
+    };
+
+    // A value for every day in a range of consecutive days, stored in a
+    // contiguous vector indexed by the Rata Die day number (see rdn in
+    // stat.cpp) minus first_day. Days without any data hold NAN
+    struct DailySeries {
+        int first_day = 0;
+        std::vector<double> values;
+
+        /**
+         * Description: sets the value of a day, the series grows to
+         * include the day if it is outside of the current range
+         * @param[in] day: the Rata Die day number of the day
+         * @param[in] value: the value of the day
+         */
+        void set(int day, double value);
+
+        /**
+         * Description: returns the value of a day, or NAN if the day has no
+         * data or is outside of the range of the series
+         * @param[in] day: the Rata Die day number of the day
+         */
+        double get(int day) const;
+
+        // The Rata Die day number of the last day in the series
+        int last_day() const { return first_day + (int) values.size() - 1; }
     };
 
     class TMDatabase {
@@ -42,13 +145,77 @@ namespace tm_db {
         // database object for handling database operations
         sqlite3 *db_;
 
+        // the path the database was opened with
+        std::string path_;
+
+        // the directory that holds the database, and the files next to it,
+        // empty for an in-memory database
+        std::string tm_dir_;
+
+        // Prepared statements keyed by their sql text, a statement is only
+        // compiled the first time it is used, and is finalized in ~TMDatabase
+        std::unordered_map<std::string, sqlite3_stmt*> stmt_cache_;
+
+        // The number of transactions begun and not yet committed or rolled
+        // back, every transaction after the first is a savepoint
+        int txn_depth_ = 0;
+
+        // The locked files of the sessions run by this process, keyed by the
+        // id of the session, see open_sess
+        std::unordered_map<int, int> sess_locks_;
+
         /**
-         * Description: gets the id of a tag in the table
-         * @param[in] tag is the tag name in question, if the tag name is
-         * invalid, this function will raise an error and exit
-         * @return returns an int of the id of the tag found in the tags table
+         * Description: checks if the process running an open session on
+         * this host is gone, it is if nothing holds the lock of the session,
+         * or for sessions without a lock file, if there is no process with
+         * the pid of the session
+         * @param[in] sess: the open session
          */
-        int tag_id(const std::string &tag);
+        bool sess_dead(const OpenSess &sess);
+
+        /**
+         * Description: gets the path of the file locked by the process
+         * running a session
+         * @param[in] sess_id: the id of the session
+         * @return the path, or an empty string if the database has no
+         * directory to hold it
+         */
+        std::string sess_lock(int sess_id) const;
+
+        /**
+         * Description: applies the connection profile to the database, the
+         * settings are read from the config file in tm_dir, then overridden
+         * by environment variables. Invalid settings raise an error and exit
+         * @param[in] tm_dir: the directory holding the database and config
+         */
+        void apply_profile(const std::string &tm_dir);
+
+        /**
+         * Description: returns a prepared statement for the sql query, if the
+         * query was already prepared, the cached statement is reset and its
+         * bindings are cleared instead of recompiling it
+         * @param[in] sql: the sql query to prepare, parameters should be
+         * bound with sqlite3_bind_* rather than formatted into the string
+         * @return returns a statement that is ready to be bound and stepped
+         */
+        sqlite3_stmt* prepare(const std::string &sql);
+
+        /**
+         * Description: steps through a prepared statement, and calls callback
+         * on every row returned in the same manner as sqlite3_exec, the
+         * statement is reset once all the rows have been processed
+         * @param[in] stmt: a statement returned by prepare
+         * @param[in] callback: the callback for each row, can be NULL
+         * @param[in] data: passed as the first argument to the callback
+         * @param[in] err_message: the message to display if there is an error
+         *     while stepping through the statement
+         * @param[in] header: printed to stdout right before the first row,
+         *     nothing is printed if the statement returns no rows
+         * @return returns the number of rows returned by the statement
+         */
+        int execute_stmt(sqlite3_stmt *stmt, const sqlite3_callback callback,
+                         void *data, const std::string &err_message,
+                         const std::string &header = "");
 
         /**
          * Description: gets the id of a task in the table
@@ -58,14 +225,6 @@ namespace tm_db {
          */
         int task_id(const std::string &task_name);
 
-        /**
-         * Description: gets the id of a proj in the table
-         * @param[in] proj_name: is the proj name in question, if the proj name
-         * is invalid, this function will raise an error and exit
-         * @return returns an int of the id of the proj found in the tags table
-         */
-        int proj_id(const std::string &proj_name);
-
         /**
          * Description: returns the number of entries in a table in the database
          * @param[in] table: the name of the table to inspect
@@ -130,6 +289,47 @@ namespace tm_db {
          */
         void create_proj_table();
 
+        /**
+         * Creates the indexes used by the queries on the tables:
+         *   tasks(complete, due): listing tasks filtered on completion
+         *   tasks(proj_id): the tasks of a project
+         *   tasks(time_done): tasks completed over a range of dates
+         *   task_tags(task_id): the tags of a task
+         *   sess(task_id, length): time worked on a task
+         *   sess(time_started): ranges of sessions, and the log
+         *   sess(date(time_started), length): time worked per day
+         */
+        void create_indexes();
+
+        /**
+         * Creates the daily_totals table, which holds the seconds worked and
+         * the number of sessions for every day and task, along with the
+         * project of the task. The triggers that keep it in sync with the
+         * sess and tasks tables are created with it, so every change to a
+         * session updates a single row of daily_totals
+         */
+        void create_rollup();
+
+        /**
+         * Creates the open_sess table, which holds the sessions that are still
+         * running, their rows in sess are written when they start and their
+         * length is updated as they go
+         * The columns are:
+         *   sess_id: the id of the session in the sess table
+         *   pid: the process running the session
+         * This is the original layout, migrate_schema adds the planned length
+         * and the maximum length of the session
+         */
+        void create_open_sess_table();
+
+        /**
+         * Description: brings the schema of the database up to
+         * SCHEMA_VERSION, each migration is applied in order inside of a
+         * single transaction, and the new version is recorded in
+         * PRAGMA user_version so that this only does work once per database
+         */
+        void migrate_schema();
+
         /**
          * Executes a sql query
          * @param[in] query: a string containing the query to be run, must be
@@ -146,15 +346,39 @@ namespace tm_db {
 
     public:
         /**
-         * Description: Creates the dotfile directory for tm if it doesn't
-         * already exist, then it opens an instance of a sqlite3 database for
-         * storing all the data from tasks, sessions, and tags
+         * Description: opens the database at the path returned by db_path
          */
         TMDatabase();
 
+        /**
+         * Description: Creates the directory of the database if it doesn't
+         * already exist, then it opens an instance of a sqlite3 database for
+         * storing all the data from tasks, sessions, and tags, and migrates
+         * its schema if it is out of date
+         * @param[in] path: the file of the database, or ":memory:" for a
+         * database that only lasts as long as this object
+         */
+        explicit TMDatabase(const std::string &path);
+
         // Deallocates the db_ object
         ~TMDatabase();
 
+        /**
+         * Description: gets the id of a tag in the table
+         * @param[in] tag is the tag name in question, if the tag name is
+         * invalid, this function will raise an error and exit
+         * @return returns an int of the id of the tag found in the tags table
+         */
+        int tag_id(const std::string &tag);
+
+        /**
+         * Description: gets the id of a proj in the table
+         * @param[in] proj_name: is the proj name in question, if the proj name
+         * is invalid, this function will raise an error and exit
+         * @return returns an int of the id of the proj found in the tags table
+         */
+        int proj_id(const std::string &proj_name);
+
         /**
          * Inserts a tag into the tags table
          * @param[in] tag: the tag to be inserted
@@ -261,6 +485,72 @@ namespace tm_db {
          */
         void remove_sess(int sess_id);
 
+        /**
+         * Description: inserts a session that is starting with a length of 0,
+         * and marks it as open until close_sess is called
+         * @param[in] start: the start date of the session in proper ISO format
+         * @param[in] task_id: the task_id of the task being worked on
+         * @param[in] description: a brief description of the sess
+         * @param[in] length: the planned length of the session, in seconds
+         * @param[in] max_length: the length at which the session ends
+         * @param[in] detached: if false, the session is run by this process
+         * @return the id of the session
+         */
+        int open_sess(const std::string &start, int task_id,
+                      const std::string &description, int length,
+                      int max_length, bool detached);
+
+        /**
+         * Description: gets every session that hasn't ended yet
+         * @return the open sessions, oldest first
+         */
+        std::vector<OpenSess> open_sessions();
+
+        /**
+         * Description: changes how long an open session lasts
+         * @param[in] sess_id: the id returned by open_sess
+         * @param[in] length: the planned length of the session, in seconds
+         * @param[in] max_length: the length at which the session ends
+         */
+        void extend_sess(int sess_id, int length, int max_length);
+
+        /**
+         * Description: gets the path of the control socket of a session
+         * @param[in] sess_id: the id of the session
+         * @return the path, or an empty string if the database has no
+         * directory to hold it
+         */
+        std::string sess_socket(int sess_id) const;
+
+        /**
+         * Description: records the time worked so far in an open session, so
+         * that it isn't lost if the process running the session dies
+         * @param[in] sess_id: the id returned by open_sess
+         * @param[in] sess_length: the time in seconds worked so far
+         */
+        void checkpoint_sess(int sess_id, int sess_length);
+
+        /**
+         * Description: records the final length of an open session, or removes
+         * it, and marks it as no longer open
+         * @param[in] sess_id: the id returned by open_sess
+         * @param[in] sess_length: the time in seconds of the sess duration
+         * @param[in] keep: if false, the session is removed from the database
+         * @return false if the session was already closed, in which case
+         * nothing is changed
+         */
+        bool close_sess(int sess_id, int sess_length, bool keep);
+
+        /**
+         * Description: closes the open sessions of processes that are no
+         * longer running on this host, keeping the length of their last
+         * checkpoint. Sessions of other hosts are left to those hosts.
+         * Sessions that were checkpointed at a minute or less are removed,
+         * like interrupted sessions are. Detached sessions are closed at
+         * their maximum length once it has passed
+         */
+        void recover_sessions();
+
         /**
          * Description: remove a project from the projects table
          * @param[in] proj_name: The name of the project to remove
@@ -298,25 +588,179 @@ namespace tm_db {
 
 
         /**
-         * Description: Queries the total amount of 
+         * Description: refreshes the statistics that the query planner uses
+         * to pick indexes, should be run after the database has grown
+         * substantially
+         */
+        void analyze();
+
+        /**
+         * Description: recomputes the daily_totals table from every session,
+         * only needed if the sess table was modified while the triggers that
+         * maintain daily_totals were missing. Should be called inside of a
+         * transaction
+         */
+        void rebuild_rollup();
+
+        /**
+         * Description: returns the directory that holds the database, where
+         * the config and the caches of tm are kept as well
+         */
+        const std::string &dir() const { return tm_dir_; }
+
+        // The path the database was opened with
+        const std::string &path() const { return path_; }
+
+        /**
+         * Description: gets the id of the last session and the number of
+         * sessions, one of which changes whenever sessions are added or
+         * removed, so together they identify the current set of sessions
+         * @param[out] last_id: the largest session id, 0 if there are none
+         * @param[out] num_sess: the number of sessions
+         */
+        void last_sess(int &last_id, int &num_sess);
+
+        /**
+         * Description: starts a transaction, or a savepoint if a transaction
+         * was already begun, so that transactions can be nested
+         * @param[in] write: take the write lock immediately so that nothing
+         * else can modify the database until commit_transaction is called
+         * @return the number of transactions that were already begun, to be
+         * passed to rollback_transaction
+         */
+        int begin_transaction(bool write = true);
+
+        /**
+         * Description: commits the innermost transaction started by
+         * begin_transaction, a savepoint is only written once every
+         * transaction it is nested in is committed
+         */
+        void commit_transaction();
+
+        /**
+         * Description: undoes every change made since a transaction began,
+         * and ends it along with every transaction nested in it
+         * @param[in] depth: the value returned by the begin_transaction of
+         * the transaction to roll back
+         */
+        void rollback_transaction(int depth);
+
+        /**
+         * Description: reads the ids of all the tags, projects and tasks
+         * @return Returns the maps from names to ids
+         */
+        IdMaps load_id_maps();
+
+        /**
+         * Description: imports a tag, if the tag already exists its color is
+         * updated. ids is updated with the id of the tag
+         * @param[in] tag: the tag to import
+         * @param[in] ids: the maps returned from load_id_maps
+         */
+        void import_tag(const Tag &tag, IdMaps &ids);
+
+        /**
+         * Description: imports a project, if the project already exists its
+         * completion status is updated. ids is updated with the id of the project
+         * @param[in] proj_name: the name of the project
+         * @param[in] complete: 1 if the project is complete, else 0
+         * @param[in] ids: the maps returned from load_id_maps
+         */
+        void import_project(const std::string &proj_name, int complete,
+                            IdMaps &ids);
+
+        /**
+         * Description: imports a task, its project and tags must already be
+         * in ids. ids is updated with the id of the new task
+         * @param[in] task: the task to import
+         * @param[in] key: the id of the task in the stream, 0 if it has none
+         * @param[in] ids: the maps returned from load_id_maps
+         */
+        void import_task(const Task &task, int key, IdMaps &ids);
+
+        /**
+         * Description: imports a session, its task must already be in ids,
+         * or be empty for sessions that don't reference a task
+         * @param[in] sess: the session to import
+         * @param[in] ids: the maps returned from load_id_maps
+         */
+        void import_sess(const Sess &sess, const IdMaps &ids);
+
+        /**
+         * Description: reads every tag, project, task and session inside a
+         * single read transaction, one statement per table, and calls
+         * callback on each row. argv[0] of a row is the type of the record
+         * ("tag", "proj", "task" or "sess"), and the rest of the columns are
+         * the fields of that record in the order defined in import.hpp, the
+         * tags of a task are separated by the ASCII unit separator.
+         * Sessions that are still open have no final length yet, so they
+         * are left out
+         * @param[in] callback: the callback for each row
+         * @param[in] data: passed as the first argument to the callback
+         */
+        void export_records(const sqlite3_callback callback, void *data);
+
+        /**
+         * Description: Queries the total amount of time worked on each day
          * @param[in] from: the starting date to query from, if it is empty, then
          * no restriction is added for the starting date
          * @param[in] until: the end date to query till, if empty no restrictions added
-         * @return Returns a mapping from dates -> time worked
+         * @param[out] series: filled with the seconds worked on every day
          */
-        std::unordered_map<std::string, double>
-        stat_time_query(const std::string &from, const std::string &until);
+        void stat_time_query(const std::string &from, const std::string &until,
+                             DailySeries &series);
 
         /**
-         * Description: Queries the total amount of 
+         * Description: Queries the number of tasks completed on each day
          * @param[in] from: the starting date to query from, if it is empty, then
          * no restriction is added for the starting date
          * @param[in] until: the end date to query till, if empty no restrictions added
-         * @return Returns a mapping from dates -> time worked
+         * @param[out] series: filled with the tasks completed on every day
          */
-        std::unordered_map<std::string, double>
-        stat_task_query(const std::string &from, const std::string &until);
+        void stat_task_query(const std::string &from, const std::string &until,
+                             DailySeries &series);
+
+        /**
+         * Description: Queries a metric for every day in a range, for a
+         * group of tasks, projects or tags at once, every group is computed
+         * in the same pass over the data
+         * @param[in] metric: "time" for the seconds worked, "sessions" for
+         * the number of sessions, or "tasks-done" for the tasks completed
+         * @param[in] group: "task", "proj" or "tag" to compute the metric
+         * separately for each id in ids, or empty to compute it over all
+         * the data, in which case the series is keyed by 0
+         * @param[in] ids: the ids of the tasks, projects or tags
+         * @param[in] from_day: the Rata Die of the first day to query
+         * @param[in] until_day: the Rata Die of the last day to query
+         * @param[out] series: the value of every day, keyed by id
+         */
+        void stat_grad_query(const std::string &metric,
+                             const std::string &group,
+                             const std::vector<int> &ids,
+                             int from_day, int until_day,
+                             std::unordered_map<int, DailySeries> &series);
     };
+
+    /**
+     * Description: returns the path of the database to open, which is set by
+     * the --db flag, then the TM_DB environment variable, and is
+     * ~/.tm.d/data.sqlite3 by default. Relative paths are made absolute
+     */
+    std::string db_path();
+
+    /**
+     * Description: sets the path of the database, overriding TM_DB, raises
+     * an error if the shared database is already open on another path
+     * @param[in] path: the file of the database, or ":memory:"
+     */
+    void set_db_path(const std::string &path);
+
+    /**
+     * Description: returns the database shared by every command this process
+     * runs, it is opened at db_path the first time it is needed and closed
+     * on exit
+     */
+    TMDatabase &shared_db();
 }
 
 #endif // DATABASE_HPP_
@@ -0,0 +1,35 @@
+//
+// All the defined constants and functions relevant to maintaining the
+// database itself, rather than the records inside of it
+//
+
+#ifndef DB_CMD_HPP_
+#define DB_CMD_HPP_
+
+#include <string>
+
+
+namespace tm_db_cmd {
+
+    // Descriptions of all the possible subcommands
+    const std::string ANALYZE_DESCRIPTION =
+        "Refresh the statistics the query planner uses to pick indexes,\n"
+        "worth running after importing or adding a large number of records";
+
+    const std::string REBUILD_DESCRIPTION =
+        "Recompute the daily totals used by tm stat from every session";
+
+    /**
+     * Description: gathers statistics about the tables and indexes of the
+     * database, so that queries keep using the right indexes as it grows
+     */
+    void handle_analyze();
+
+    /**
+     * Description: recomputes the daily totals of time worked from the
+     * sessions, they are normally kept up to date as sessions change
+     */
+    void handle_rebuild();
+}
+
+#endif // DB_CMD_HPP_
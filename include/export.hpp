@@ -0,0 +1,36 @@
+//
+// All the defined constants and functions relevant to exporting the whole
+// database as a stream of JSONL or CSV records
+//
+// The records are written in the same layout that tm import reads, which is
+// documented in import.hpp, so the output of tm export can be imported back
+//
+
+#ifndef EXPORT_HPP_
+#define EXPORT_HPP_
+
+#include <string>
+
+
+namespace tm_export {
+
+    // Descriptions of all the possible flags
+    const std::string FILE_DESCRIPTION =
+        "The file to write the records to, by default they are written to stdout";
+
+    const std::string FORMAT_DESCRIPTION =
+        "The format of the records, either 'jsonl' or 'csv', by default\n"
+        "it is inferred from the file extension, falling back to jsonl";
+
+    /**
+     * Description: writes every tag, project, task and session to a file
+     * or stdout, the records are streamed so memory use stays bounded
+     * regardless of the size of the database
+     * @param[in] file_name: the file to write, writes to stdout if empty
+     * @param[in] format: either "jsonl" or "csv", if empty the format is
+     * inferred from the extension of file_name
+     */
+    void handle_export(const std::string &file_name, std::string format);
+}
+
+#endif // EXPORT_HPP_
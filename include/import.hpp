@@ -0,0 +1,64 @@
+//
+// All the defined constants and functions relevant to importing tags,
+// projects, tasks and sessions in bulk from a JSONL or CSV stream
+//
+// Every line is one record, the first field of a record is its type:
+//   tag:  name, color
+//   proj: name, complete
+//   task: name, project, due, complete, time_done, tags, id
+//   sess: task, time_started, length, desc, task_id
+//
+// JSONL records are objects with a "type" key and the fields above as keys,
+// where tags is an array of strings. CSV records list the fields in the
+// order above, with the tags of a task separated by ';'
+//
+// Projects, tags and tasks are referenced by name, so a record can only
+// reference names that exist in the database or appear earlier in the
+// stream. Since task names aren't unique, a session can instead reference
+// its task by task_id, the id of a task record earlier in the stream, which
+// is what tm export writes. In CSV, a ';' or '\' inside of a tag name is
+// escaped with a '\'. Dates can be YYYY-MM-DD, YYYY-MM-DD HH:MM or
+// YYYY-MM-DD HH:MM:SS.SSS
+//
+
+#ifndef IMPORT_HPP_
+#define IMPORT_HPP_
+
+#include <string>
+#include <vector>
+
+
+namespace tm_import {
+
+    // Descriptions of all the possible flags
+    const std::string FILE_DESCRIPTION =
+        "The file to import records from, by default they are read from stdin";
+
+    const std::string FORMAT_DESCRIPTION =
+        "The format of the records, either 'jsonl' or 'csv', by default\n"
+        "it is inferred from the file extension, falling back to jsonl";
+
+    // The fields of each record type, in the order they appear in CSV
+    const std::vector<std::string> TAG_FIELDS = {"name", "color"};
+
+    const std::vector<std::string> PROJ_FIELDS = {"name", "complete"};
+
+    const std::vector<std::string> TASK_FIELDS = {
+        "name", "project", "due", "complete", "time_done", "tags", "id"
+    };
+
+    const std::vector<std::string> SESS_FIELDS = {
+        "task", "time_started", "length", "desc", "task_id"
+    };
+
+    /**
+     * Description: imports all the records from a file or stdin inside a
+     * single transaction, if any record is invalid nothing is imported
+     * @param[in] file_name: the file to read, reads stdin if empty
+     * @param[in] format: either "jsonl" or "csv", if empty the format is
+     * inferred from the extension of file_name
+     */
+    void handle_import(const std::string &file_name, std::string format);
+}
+
+#endif // IMPORT_HPP_
@@ -0,0 +1,45 @@
+//
+// All the defined constants and functions relevant to the tm daemon, which
+// keeps the database open and runs the commands of other tm processes
+//
+// A client sends its command over a Unix socket in ~/.tm.d as:
+//   u32 cols, u8 is_tty, u32 length, database path,
+//   u32 argc, then argc times: u32 length, bytes
+// and the daemon answers with a u8 that is 0 if it has a different database
+// open, in which case the client runs the command itself, otherwise with:
+//   u8 1, i32 status, u8 paged, u32 length, stdout, u32 length, stderr
+// where every integer is in native byte order, since both ends are on the
+// same machine
+//
+
+#ifndef SERVE_HPP_
+#define SERVE_HPP_
+
+#include <string>
+
+// The socket of the daemon, inside of the tm directory
+#define SOCKET_FILE "/tm.sock"
+
+
+namespace tm_serve {
+
+    /**
+     * Description: runs the daemon in the foreground until it is interrupted
+     * or terminated, the commands of the clients are run one at a time,
+     * each inside of its own transaction
+     */
+    void handle_serve();
+
+    /**
+     * Description: sends a command to the daemon and writes its output, if
+     * the daemon is running and the command can be run by it. Commands that
+     * read or write files, stdin or the terminal are always run locally
+     * @param[in] argc: the number of arguments, including the program name
+     * @param[in] argv: the arguments, in the same form as main receives them
+     * @param[out] status: the exit status of the command, if it was sent
+     * @return true if the command was run by the daemon
+     */
+    bool forward(int argc, char **argv, int &status);
+}
+
+#endif // SERVE_HPP_
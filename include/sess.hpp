@@ -13,6 +13,9 @@
 // Default session of 25 min, based on pomodoro technique
 #define DEFAULT_SESS_LENGTH 25
 
+// Default seconds between the writes of the length of a running session
+#define DEFAULT_CHECKPOINT 10
+
 namespace tm_sess {
 
     // Descriptions of all the possible flags and subcommands
@@ -32,6 +35,39 @@ namespace tm_sess {
         "No overtime means the session will end immediately\nupon reaching the time limit"\
         " otherwise, the session will keep going until the\nuser stops it";
 
+    const std::string REFRESH_DESCRIPTION =
+        "Seconds between updates of the progress bar, by default every\n"
+        "second on a terminal and every minute when output is redirected";
+
+    const std::string CHECKPOINT_DESCRIPTION =
+        "Seconds between saves of the time worked so far, which is kept\n"
+        "if tm is killed, and recovered the next time tm runs";
+
+    const std::string DETACH_DESCRIPTION =
+        "Record the start of the session and exit, instead of showing a\n"
+        "timer until it ends, stop it with 'tm sess stop'";
+
+    const std::string STOP_DESCRIPTION =
+        "Stops a running or detached session, and records how long it lasted";
+
+    const std::string PAUSE_DESCRIPTION =
+        "Pauses a session running in another terminal, the time it is\n"
+        "paused for doesn't count towards its length";
+
+    const std::string RESUME_DESCRIPTION = "Resumes a paused session";
+
+    const std::string EXTEND_DESCRIPTION =
+        "Adds time to a running or detached session";
+
+    const std::string EXTEND_LENGTH_DESCRIPTION =
+        "The minutes to add to the session";
+
+    const std::string CONTROL_ID_DESCRIPTION =
+        "The id of the session, by default the one started last";
+
+    const std::string STATUS_DESCRIPTION =
+        "Shows the sessions that are running, and the time left in each";
+
     const std::string DESC_DESCRIPTION =
         "Add a brief description you plan to do during the session";
 
@@ -75,10 +111,54 @@ namespace tm_sess {
      * time is over, otherwise it continues for up to 50% more time
      * @param[in] task_id: the task id of the task being worked on
      * @param[in] description: A quick description of the session's goals
+     * @param[in] refresh: the seconds between updates of the progress bar, if
+     * 0 it is 1 on a terminal and 60 otherwise
+     * @param[in] checkpoint: the seconds between saves of the length of the
+     * session to the database
+     * @param[in] detach: if true, the session is recorded as started and
+     * this returns immediately, it lasts until handle_stop or its limit
      */
     void handle_start(int sess_length, bool no_interrupt,
                       bool no_overtime, int task_id,
-                      const std::string &description);
+                      const std::string &description, int refresh,
+                      int checkpoint, bool detach);
+
+    /**
+     * Description: stops a session, a detached session is closed with the
+     * time since it started, up to its limit, while a session in the
+     * foreground is told to stop through its control socket. Like an
+     * interrupted session, it is discarded if it lasted a minute or less
+     * @param[in] sess_id: the id of the session, or 0 for the latest one
+     */
+    void handle_stop(int sess_id);
+
+    /**
+     * Description: pauses a session running in the foreground, the time it
+     * is paused for doesn't count towards its length
+     * @param[in] sess_id: the id of the session, or 0 for the latest one
+     */
+    void handle_pause(int sess_id);
+
+    /**
+     * Description: resumes a paused session
+     * @param[in] sess_id: the id of the session, or 0 for the latest one
+     */
+    void handle_resume(int sess_id);
+
+    /**
+     * Description: adds time to the planned length of a session, and to its
+     * overtime if it has any
+     * @param[in] sess_id: the id of the session, or 0 for the latest one
+     * @param[in] minutes: the minutes to add
+     */
+    void handle_extend(int sess_id, int minutes);
+
+    /**
+     * Description: prints every session that is running, with the time
+     * worked so far and the time left, or the overtime worked. Sessions in
+     * the foreground are asked for their time, since they can be paused
+     */
+    void handle_status();
 
 
     /**
@@ -8,9 +8,10 @@
 
 #include <iostream>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "database.hpp"
+
 
 namespace tm_stat {
 
@@ -39,6 +40,25 @@ namespace tm_stat {
 
     const std::string GRAD_DESCRIPTION =
         "Display a heatmap of various progress metrics";
+
+    const std::string GRAD_TASK_DESCRIPTION =
+        "Display a heatmap for each of these task ids";
+
+    const std::string GRAD_PROJ_DESCRIPTION =
+        "Display a heatmap for each of these projects";
+
+    const std::string GRAD_TAG_DESCRIPTION =
+        "Display a heatmap for each of these tags";
+
+    const std::string GRAD_YEAR_DESCRIPTION =
+        "Display each of these years from January to December, by default\n"
+        "the heatmap shows the past 52 weeks\nFormat: 'YYYY'";
+
+    const std::string METRIC_DESCRIPTION =
+        "The metric to display, either 'time', 'sessions' or 'tasks-done'";
+
+    const std::string COLOR_DESCRIPTION =
+        "The color of the heatmap: orange, gray, green, blue or magenta";
     /**
      * Description: prints a summar
      * @param[in] sum_tasks: print a summary related to tasks, not about time
@@ -57,52 +77,85 @@ namespace tm_stat {
                         const std::string &until);
 
     /**
-     * Description: Displays a gradient heatmap of the progress  worked on
-     * TODO: Add more options for this like task id and proj id
+     * Description: Displays gradient heatmaps of the progress worked on,
+     * one for every task, project and tag given, or a single one for all
+     * the data if none are given. Every group of the same kind is queried
+     * in one pass
+     * @param[in] tasks: the ids of the tasks to display
+     * @param[in] projs: the names of the projects to display
+     * @param[in] tags: the names of the tags to display
+     * @param[in] years: display each year from January to December, if
+     * empty the past 52 weeks are displayed
+     * @param[in] metric: "time", "sessions" or "tasks-done"
+     * @param[in] color: the color of the gradient
+     *
+     * Note: the heatmap of all the data is cached along with the sessions,
+     * day, options and terminal width it was rendered for, so it is only
+     * rendered again when one of them changes
      */
-    void handle_grad();
+    void handle_grad(const std::vector<int> &tasks,
+                     const std::vector<std::string> &projs,
+                     const std::vector<std::string> &tags,
+                     const std::vector<int> &years,
+                     const std::string &metric,
+                     const std::string &color);
 
     /**
      * Description: Class for handling statistics processing
      */
     class StatHandler {
     private:
-        // a map that maps dates -> values
-        std::unordered_map<std::string, double> data_;
+        // the value of every day in the dataset
+        tm_db::DailySeries data_;
+
+        // Statistics over the days in data_ that have a value
+        tm_math::RunningStats stats_;
+
+        // The sum and number of the values on each day of the week,
+        // 0 is Sunday, 6 is Saturday
+        double weekday_sum_[7] = {};
+        int weekday_count_[7] = {};
 
-        // A list of the values found in data_
-        std::vector<double> vals_;
+        // The Rata Die of the starting date and final date in the dataset
+        int min_day, max_day;
 
-        // Specifies the starting date and final date in the dataset
-        std::string min_date, max_date;
+        // The length and the Rata Die of the last day of the longest run of
+        // consecutive days that have a value
+        int streak_len_ = 0, streak_end_ = 0;
 
         /**
-         * Description: loads all the values from data_ into vals_
+         * Description: computes all the statistics over data_ in one pass
          */
         inline void load_vals();
     public:
 
         /**
-         * @param[in] data: a map that maps dates -> values
+         * @param[in] data: the value of every day, moved into the handler
          */
-        StatHandler(const std::unordered_map<std::string, double> &data);
+        StatHandler(tm_db::DailySeries data);
 
         /**
          * Description: Outputs a summary about the statistics observed
          *
          * Outputs the start date and end date found in the observed data
-         * Outputs mean, standard deviation, and total number of items
-         * observed
+         * Outputs mean, standard deviation, median, 90th percentile, and
+         * total number of items observed, along with the longest streak of
+         * consecutive days and the average of each day of the week
          */
         void output_summary(std::ostream &out = std::cout);
 
         /**
-        * Description: Prints a gradient map of your progress, in a similar style to
-        * Github with its contribution chart
+        * Description: Renders a gradient map of your progress, in a similar style to
+        * Github with its contribution chart, the whole map is built in buf and
+        * uses integer day numbers for all the calendar math
+        * @param[out] buf: the rendered map is appended to buf
         * @param[in] color: the color of the gradient, must be a valid color from the
         * tm_color::VALID_GRADIENTS set
+        * @param[in] first_day: the Rata Die of the first day shown
+        * @param[in] last_day: the Rata Die of the last day shown
         */
-        void gradient_map(std::string color = "green", std::ostream &out = std::cout);
+        void gradient_map(std::string &buf, const std::string &color,
+                          int first_day, int last_day);
     };
 }
 
@@ -13,6 +13,11 @@
 #include "sess.hpp"
 #include "project.hpp"
 #include "stat.hpp"
+#include "import.hpp"
+#include "export.hpp"
+#include "db_cmd.hpp"
+#include "batch.hpp"
+#include "serve.hpp"
 
 
 namespace tm_cli {
@@ -21,6 +26,10 @@ namespace tm_cli {
 
     const std::string VERSION_FLAG_DESCRIPTION = "Display tm version info";
 
+    const std::string DB_FLAG_DESCRIPTION =
+        "The database file to use, or ':memory:' for an empty database that\n"
+        "is discarded on exit, overrides the TM_DB environment variable";
+
     // Description that will be passed into a CLI::App instantiation when
     // parsing the arguments
     const std::string DESCRIPTION = "tm, the task manager right in your terminal.";
@@ -40,6 +49,32 @@ namespace tm_cli {
 
     const std::string PROJ_DESCRIPTION =
         "Allows for the modification of projects, which are composed of multiple tasks";
+
+    const std::string IMPORT_DESCRIPTION =
+        "Import tags, projects, tasks and sessions in bulk from JSONL or CSV";
+
+    const std::string EXPORT_DESCRIPTION =
+        "Export all the tags, projects, tasks and sessions as JSONL or CSV";
+
+    const std::string DB_DESCRIPTION =
+        "Maintenance of the database that stores all of your data";
+
+    const std::string BATCH_DESCRIPTION =
+        "Run the tm commands read from stdin, one per line, in a single\n"
+        "transaction, a command that fails is rolled back on its own";
+
+    const std::string SERVE_DESCRIPTION =
+        "Keep the database open and run the commands of other tm processes,\n"
+        "which forward their commands to it while it is running";
+
+    /**
+     * Description: parses the arguments of a single tm command and runs it,
+     * errors raise a tm_utils::CommandError once they have been printed
+     * @param[in] argc: the number of arguments, including the program name
+     * @param[in] argv: the arguments, in the same form as main receives them
+     * @return the exit status of the command
+     */
+    int run(int argc, char **argv);
 }
 
 #endif // TM_HPP_
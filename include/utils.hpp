@@ -10,8 +10,10 @@
 #include <sys/ioctl.h> 
 #include <unistd.h>
 
+#include <cstdint>
 #include <string>
 #include <vector>
+#include <exception>
 #include <unordered_set>
 #include <unordered_map>
 #include <sstream>
@@ -21,6 +23,18 @@
 
 
 namespace tm_utils {
+    /**
+     * Description: thrown by a command once it has printed why it failed,
+     * main exits with status 1 when it catches one, while tm batch rolls
+     * back the command and carries on with the next one
+     */
+    class CommandError : public std::exception {
+    public:
+        const char* what() const noexcept override {
+            return "tm command failed";
+        }
+    };
+
     /**
      * Checks if a folder exists
      * @param foldername path to the folder to check.
@@ -49,6 +63,12 @@ namespace tm_utils {
      */
     std::string home_dir();
 
+    /**
+     * Returns the name of the host tm is running on
+     * @return the host name, or an empty string if it is unknown
+     */
+    std::string host_name();
+
     /**
      * asserts that the date is in proper format and also valid
      * @param[in] date: a string of the form (ideally) of YYYY-MM-DD
@@ -70,6 +90,40 @@ namespace tm_utils {
      */
     std::string current_datetime();
 
+    /**
+     * Description: converts a number of days since 1970-01-01 into a date
+     * @param[in] days: the days since 1970-01-01
+     * @param[out] year: the year of the date
+     * @param[out] month: the month of the date, from 1-12
+     * @param[out] day: the day of the month, from 1-31
+     */
+    void civil_from_days(long long days, int &year, int &month, int &day);
+
+    /**
+     * Description: converts a date and time into the number of seconds since
+     * 1970-01-01 00:00, which is how dates are stored in the database. Dates
+     * are kept in local time without a timezone, the same way they are shown,
+     * so every day spans exactly 86400 seconds
+     * @param[in] datetime: YYYY-MM-DD, optionally followed by HH:MM or
+     * HH:MM:SS.SSS, the date must already be valid
+     * @return Returns the seconds since the epoch
+     */
+    long long to_epoch(const std::string &datetime);
+
+    /**
+     * Description: converts seconds since the epoch, as returned by to_epoch,
+     * back into a date and time
+     * @param[in] epoch: the seconds since 1970-01-01 00:00
+     * @return Returns a string of the form YYYY-MM-DD HH:MM
+     */
+    std::string epoch_to_datetime(long long epoch);
+
+    /**
+     * Description: returns the current local date and time in seconds since
+     * the epoch, in the same way as to_epoch
+     */
+    long long current_epoch();
+
     /**
      * Description: creates a string out of the number of seconds 
      * @param[in] num_seconds: the number of seconds to convert
@@ -97,12 +151,75 @@ namespace tm_utils {
     void remove_file(std::string file_name);
 
     /**
-     * Description: Returns the number of columns in the terminal
+     * Description: checks if a file name ends with an extension
+     * @param[in] file_name: the name of the file
+     * @param[in] ext: the extension, including the '.'
+     * @return true if file_name ends with ext
+     */
+    bool has_extension(const std::string &file_name, const std::string &ext);
+
+    /**
+     * Description: removes the whitespace at both ends of a string
+     * @param[in] str: the string to trim
+     * @return a copy of str without leading or trailing whitespace
+     */
+    std::string trim(const std::string &str);
+
+    /**
+     * Description: splits a command line into words in the same way as a
+     * shell, words are separated by whitespace and can be quoted with ' or ",
+     * and a \ outside of single quotes escapes the next character
+     * @param[in] line: the command line to split
+     * @param[out] args: the words of the line are appended to args
+     * @return false if the line ends inside of a quote
+     */
+    bool split_args(const std::string &line, std::vector<std::string> &args);
+
+    /**
+     * Description: writes all of buf to a file descriptor, retrying on partial
+     * writes and interrupts
+     * @return false if the write failed
+     */
+    bool write_all(int fd, const char *buf, size_t len);
+
+    /**
+     * Description: reads exactly len bytes from a file descriptor
+     * @return false if the read failed or the other end closed it first
+     */
+    bool read_all(int fd, char *buf, size_t len);
+
+    /**
+     * Description: displays text through the user's $PAGER (less by default)
+     * if stdout is a terminal, otherwise it is written to stdout at once
+     * @param[in] output: the text to display
+     */
+    void page_output(const std::string &output);
+
+    // The terminal of the client that tm serve is running a command for,
+    // which is used instead of the terminal of stdout while active is set
+    struct ClientTerminal {
+        bool active = false;
+        int cols = 0;
+        bool is_tty = false;
+        // Set by page_output, so that the client pages the output itself
+        bool paged = false;
+    };
+
+    extern ClientTerminal client_term;
+
+    /**
+     * Description: Returns the number of columns in the terminal, or 0 if
+     * stdout isn't a terminal
      */
     inline int num_cols() {
+        if (client_term.active) {
+            return client_term.cols;
+        }
 #ifndef _WIN32
         struct winsize size;
-        ioctl(STDOUT_FILENO,TIOCGWINSZ,&size);
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0) {
+            return 0;
+        }
         return size.ws_col;
 #else
 #include <windows.h>
@@ -112,47 +229,129 @@ namespace tm_utils {
         return columns;
 #endif
     }
-}
-
-namespace tm_math {
 
     /**
-     * Description: Computes the mean of the vector of numbers
-     * @param[in] nums: the vector of numbers
-     * @return returns the average of the values, in the same numeric type as
-     * recieved, so if nums was a vector of ints, the average will be an int
+     * Description: Redraws a single line of the terminal, such as a progress
+     * bar. A frame is composed one column at a time into a reusable buffer,
+     * and only the columns that changed since the previous frame are written,
+     * with a single write per frame. If stdout isn't a terminal, every frame
+     * is written as a whole line instead
      */
-    template <typename NumericType>
-    NumericType mean(std::vector<NumericType> nums) {
-        // Check to make sure that the NumericType is arithmentic
-        static_assert(std::is_arithmetic<NumericType>::value,
-                      "NumericType must be numeric");
+    class LineRenderer {
+    private:
+        bool is_tty_;
+        int width_ = 0;
+
+        // The code point of every column of the previous and current frame
+        std::vector<uint32_t> prev_, cur_;
+
+        // The bytes written for a frame, kept to reuse its memory
+        std::string out_;
+
+        // Set when the line on screen no longer matches prev_
+        bool redraw_ = true;
+    public:
+        LineRenderer();
 
-        NumericType sum = 0;
-        for (auto const& it : nums) {
-            sum += it;
+        bool is_tty() const { return is_tty_; }
+
+        // The width of the terminal, as of the last call to resize
+        int width() const { return width_; }
+
+        /**
+         * Description: reads the width of the terminal again, and redraws
+         * the whole line on the next frame, called when it is resized
+         */
+        void resize();
+
+        // Starts composing a new frame
+        void begin() { cur_.clear(); }
+
+        // Appends a column to the frame
+        void put(uint32_t c) { cur_.push_back(c); }
+
+        // Appends every character of an ASCII string to the frame
+        void put(const char *text) {
+            while (*text != '\0') {
+                cur_.push_back((unsigned char) *text++);
+            }
         }
-        return sum / (NumericType) nums.size();
-    }
 
+        /**
+         * Description: writes the frame composed since begin, or only the
+         * columns that differ from the previous frame on a terminal
+         */
+        void end();
+
+        /**
+         * Description: moves to the next line, so that other output doesn't
+         * overwrite the last frame, the next frame is drawn on a new line
+         */
+        void finish();
+    };
+}
+
+namespace tm_math {
+
+// The relative error of the quantiles estimated by RunningStats, each bucket
+// of its histogram covers values within this fraction of each other
+#define QUANTILE_ERR 0.01
 
     /**
-     * Description: Takes in a vector of numeric types, and then returns the
-     * standard deviation, requires the mean to have been precomputed
-     * @param[in] nums: vector of nums
-     * @param[in] mean: the mean of the vector
-     * @return a floating point value of the precomputed value
+     * Description: Accumulates a stream of values in a single pass, without
+     * keeping them in memory. The count, mean, variance, min and max are
+     * exact and updated with Welford's algorithm, while the quantiles are
+     * estimated from a histogram with logarithmically sized buckets, so that
+     * they are within QUANTILE_ERR of the true value
      */
-    template <typename NumericType>
-    double standard_dev(std::vector<NumericType> nums, NumericType mean) {
-        static_assert(std::is_arithmetic<NumericType>::value,
-                      "NumericType must be numeric");
-        double sum = 0.0;
-        for (auto const &it : nums) {
-            sum += pow((it - mean), 2);
-        }
-        return sqrt(sum / nums.size());
-    }
+    class RunningStats {
+    private:
+        long long count_ = 0;
+        double mean_ = 0.0;
+
+        // The sum of the squared differences from the current mean
+        double m2_ = 0.0;
+
+        double min_ = 0.0, max_ = 0.0;
+
+        // The number of positive values in each bucket, bucket i counts
+        // the values in (gamma^(i + offset - 1), gamma^(i + offset)]
+        std::vector<long long> buckets_;
+        int bucket_offset_ = 0;
+
+        // Values that are 0 or negative don't fit in a bucket
+        long long non_positive_ = 0;
+    public:
+        /**
+         * Description: adds a value to the statistics
+         * @param[in] val: the value to add
+         */
+        void add(double val);
+
+        long long count() const { return count_; }
+        double mean() const { return mean_; }
+        double min() const { return min_; }
+        double max() const { return max_; }
+
+        /**
+         * Description: returns the population variance of the values
+         */
+        double variance() const;
+
+        /**
+         * Description: returns the population standard deviation of the values
+         */
+        double standard_dev() const;
+
+        /**
+         * Description: estimates a quantile of the values, values that are
+         * 0 or negative are estimated as the minimum
+         * @param[in] q: the quantile to estimate, from 0 to 1, so 0.5 is the
+         * median
+         * @return the estimate, or 0 if no values were added
+         */
+        double quantile(double q) const;
+    };
 
 
 // This is used in case the max and min values are the same, so
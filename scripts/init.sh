@@ -1,12 +1,12 @@
 #!/usr/bin/env bash
 
-# Initialize tm with tags
-echo 'Initializing tags'
-tm tag add --name 'programming' --color 'light-blue'
-tm tag add --name 'math' --color 'blue'
-tm tag add --name 'financial' --color 'green'
-
-# Add Generic Projects
-echo 'Adding Generic Projects'
-tm proj add --name 'Misc'
-tm proj add --name 'Ornus'
+# Initialize tm with tags and generic projects, everything is imported
+# in a single transaction
+echo 'Initializing tags and adding generic projects'
+tm import --format csv <<'RECORDS'
+tag,programming,light-blue
+tag,math,blue
+tag,financial,green
+proj,Misc,0
+proj,Ornus,0
+RECORDS
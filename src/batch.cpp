@@ -0,0 +1,148 @@
+//
+// Implementations of the subroutines for running tm commands in batches
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tm.hpp"
+#include "batch.hpp"
+#include "database.hpp"
+#include "utils.hpp"
+
+
+// Set while a batch is running, since a batch cannot run another one
+static bool in_batch = false;
+
+
+/**
+ * Description: returns true while handle_batch is reading commands from
+ * stdin, so that the commands it runs don't read stdin themselves
+ */
+bool tm_batch::running() {
+    return in_batch;
+}
+
+
+/**
+ * Description: checks if a command only reads the database, so that it can
+ * run without holding the write lock, which would block other tm processes
+ * @param[in] args: the arguments of the command, starting with "tm"
+ */
+static bool read_only(const std::vector<std::string> &args) {
+    size_t cmd = 1;
+    if (args.size() > 1 && args[1] == "--db") {
+        cmd = 3;
+    } else if (args.size() > 1 && args[1].compare(0, 5, "--db=") == 0) {
+        cmd = 2;
+    }
+    if (args.size() <= cmd) {
+        return true;
+    }
+    const std::string &command = args[cmd];
+    std::string sub = args.size() > cmd + 1 ? args[cmd + 1] : "";
+    if (command == "stat" || command == "export") {
+        return true;
+    } else if (command == "task" || command == "proj" || command == "tag") {
+        return sub == "list";
+    }
+    return command == "sess" && (sub == "log" || sub == "status");
+}
+
+
+/**
+ * Description: runs a single command inside of its own transaction, or
+ * savepoint if a transaction was already begun, so that a failed command
+ * leaves no changes behind. Commands that only read take the write lock
+ * once they write, if ever
+ * @param[in] db: the database shared by the commands
+ * @param[in] args: the arguments of the command, starting with "tm"
+ * @return the exit status of the command
+ */
+int tm_batch::run_command(tm_db::TMDatabase &db,
+                          const std::vector<std::string> &args) {
+    std::vector<char*> argv;
+    for (auto &arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(NULL);
+
+    int depth = db.begin_transaction(!read_only(args));
+    int status;
+    try {
+        // Opening the database recovers sessions, but it is only opened once
+        // by a batch or by tm serve, and sessions can expire in the meantime
+        db.recover_sessions();
+        status = tm_cli::run((int) args.size(), argv.data());
+    } catch (const tm_utils::CommandError &) {
+        status = 1;
+    } catch (const std::exception &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        status = 1;
+    }
+    if (status != 0) {
+        db.rollback_transaction(depth);
+    } else {
+        db.commit_transaction();
+    }
+    return status;
+}
+
+
+/**
+ * Description: runs every command read from stdin against the same database
+ * inside a single transaction. A command that fails is rolled back and
+ * reported along with its line number, and the commands after it still run
+ */
+void tm_batch::handle_batch() {
+    if (in_batch) {
+        std::cerr << "ERROR: tm batch cannot be run inside of a batch"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
+    in_batch = true;
+
+    auto &db = tm_db::shared_db();
+    db.begin_transaction();
+
+    std::string line;
+    std::vector<std::string> args;
+    int line_num = 0;
+    int num_commands = 0;
+    int num_failed = 0;
+    while (std::getline(std::cin, line)) {
+        ++line_num;
+        std::string command = tm_utils::trim(line);
+        if (command.empty() || command[0] == '#') {
+            continue;
+        }
+
+        ++num_commands;
+        args.assign(1, "tm");
+        bool ok = tm_utils::split_args(command, args);
+        if (ok && args.size() > 1 && args[1] == "tm") {
+            args.erase(args.begin() + 1);
+        }
+        if (!ok) {
+            std::cerr << "ERROR: unterminated quote" << std::endl;
+        } else {
+            ok = run_command(db, args) == 0;
+        }
+        if (!ok) {
+            // Flushed first, so the report comes after the command's output
+            std::cout << std::flush;
+            std::cerr << "ERROR: line " << line_num << " failed and was"
+                      << " rolled back: " << command << std::endl;
+            ++num_failed;
+        }
+    }
+    db.commit_transaction();
+    in_batch = false;
+
+    if (num_failed > 0) {
+        std::cerr << "ERROR: " << num_failed << " of " << num_commands
+                  << " commands failed" << std::endl;
+        throw tm_utils::CommandError();
+    }
+}
@@ -4,51 +4,325 @@
 
 #include <stdlib.h>
 #include <sqlite3.h>
+#include <math.h>
+#include <limits.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
 
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
 
 #include "database.hpp"
 
 /**
- * Description: Creates the dotfile directory for tm if it doesn't already
- * exist, then it opens an instance of a sqlite3 database for storing all the
- * data from tasks, sessions, and tags
+ * Description: opens the database at the path returned by db_path
  */
-tm_db::TMDatabase::TMDatabase() {
-    // Creates the directory for the database
-    std::string homedir = tm_utils::home_dir();
-    std::string tm_dir = homedir + TM_DIR;
-    tm_utils::mkdir(tm_dir.c_str());
+tm_db::TMDatabase::TMDatabase() : TMDatabase(db_path()) {}
 
-    std::string db_file = tm_dir + DB_FILE;
-    int exit_code = sqlite3_open(db_file.c_str(), &db_);
 
-    if (exit_code) {
-#ifndef _WIN32
-        system("mkdir ~/.tm.d/");
-        exit_code = sqlite3_open(db_file.c_str(), &db_);
-        if (exit_code) {
-#endif
-            std::cerr << "Error opening database "
-                      << sqlite3_errmsg(this->db_) << std::endl;
-            exit(1);
-#ifndef _WIN32
+/**
+ * Description: Creates the directory of the database if it doesn't already
+ * exist, then it opens an instance of a sqlite3 database for storing all the
+ * data from tasks, sessions, and tags, and migrates its schema if it is out
+ * of date
+ * @param[in] path: the file of the database, or ":memory:" for a database
+ * that only lasts as long as this object
+ */
+tm_db::TMDatabase::TMDatabase(const std::string &path) : path_(path) {
+    // An in-memory database has no directory, so no config file or cache
+    // is read or written for it
+    if (path != ":memory:") {
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos) {
+            this->tm_dir_ = ".";
+        } else {
+            this->tm_dir_ = slash == 0 ? "/" : path.substr(0, slash);
         }
-#endif
+        tm_utils::mkdir(this->tm_dir_.c_str());
+    }
+
+    int exit_code = sqlite3_open(path.c_str(), &db_);
+    if (exit_code) {
+        std::cerr << "Error opening database '" << path << "': "
+                  << sqlite3_errmsg(this->db_) << std::endl;
+        sqlite3_close(this->db_);
+        throw tm_utils::CommandError();
     }
+    this->apply_profile(this->tm_dir_);
+    this->migrate_schema();
+    this->recover_sessions();
 }
 
 
-// Closes the database
+// Finalizes all the cached statements and closes the database
 tm_db::TMDatabase::~TMDatabase() {
+    for (auto &it : this->sess_locks_) {
+        close(it.second);
+    }
+    for (auto &it : this->stmt_cache_) {
+        sqlite3_finalize(it.second);
+    }
     sqlite3_close(this->db_);
 }
 
 
+// The path set by the --db flag, and whether shared_db has opened it
+static std::string db_path_flag;
+static bool shared_db_open = false;
+
+
+/**
+ * Description: returns the path of the database to open, which is set by the
+ * --db flag, then the TM_DB environment variable, and is ~/.tm.d/data.sqlite3
+ * by default. Relative paths are made absolute
+ */
+std::string tm_db::db_path() {
+    std::string path = db_path_flag;
+    const char *env = getenv("TM_DB");
+    if (path.empty() && env != NULL) {
+        path = env;
+    }
+    if (path.empty()) {
+        return tm_utils::home_dir() + TM_DIR + DB_FILE;
+    }
+    // Made absolute, so that tm serve and its clients agree on the file
+    char cwd[PATH_MAX];
+    if (path != ":memory:" && path[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+        path = std::string(cwd) + "/" + path;
+    }
+    return path;
+}
+
+
+/**
+ * Description: sets the path of the database, overriding TM_DB, raises an
+ * error if the shared database is already open on another path
+ * @param[in] path: the file of the database, or ":memory:"
+ */
+void tm_db::set_db_path(const std::string &path) {
+    std::string prev_path = db_path();
+    db_path_flag = path;
+    if (shared_db_open && db_path() != prev_path) {
+        db_path_flag = prev_path;
+        std::cerr << "ERROR: cannot switch to the database '" << path
+                  << "', since '" << prev_path << "' is already open"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
+}
+
+
+/**
+ * Description: returns the database shared by every command this process
+ * runs, it is opened at db_path the first time it is needed and closed on
+ * exit
+ */
+tm_db::TMDatabase &tm_db::shared_db() {
+    static TMDatabase db(db_path());
+    shared_db_open = true;
+    return db;
+}
+
+
+/**
+ * Description: exits with an error if value is not one of the options of
+ * a pragma, the value is converted to upper case so that it can be pasted
+ * into the pragma statement
+ * @param[in] key: the name of the setting, for the error message
+ * @param[in] value: the value of the setting
+ * @param[in] options: the valid values of the setting, in upper case
+ */
+static void check_option(const std::string &key, std::string &value,
+                         const std::vector<std::string> &options) {
+    std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+    if (std::find(options.begin(), options.end(), value) == options.end()) {
+        std::cerr << "ERROR: '" << value << "' is not a valid value for "
+                  << key << std::endl;
+        throw tm_utils::CommandError();
+    }
+}
+
+
+/**
+ * Description: sets a field of a connection profile from its string value,
+ * exits with an error if the key is unknown or the value is invalid
+ * @param[in] profile: the profile to modify
+ * @param[in] key: the name of the field, in lower case
+ * @param[in] value: the value of the field
+ */
+static void set_profile_field(tm_db::ConnProfile &profile,
+                              const std::string &key, std::string value) {
+    char *end = NULL;
+    long long number = strtoll(value.c_str(), &end, 10);
+    bool is_number = !value.empty() && *end == '\0';
+
+    if (key == "journal_mode") {
+        check_option(key, value,
+                {"WAL", "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "OFF"});
+        profile.journal_mode = value;
+    } else if (key == "synchronous") {
+        check_option(key, value, {"OFF", "NORMAL", "FULL", "EXTRA"});
+        profile.synchronous = value;
+    } else if (key == "temp_store") {
+        check_option(key, value, {"DEFAULT", "FILE", "MEMORY"});
+        profile.temp_store = value;
+    } else if (key == "mmap_size" && is_number && number >= 0) {
+        profile.mmap_size = number;
+    } else if (key == "cache_size" && is_number) {
+        profile.cache_size = number;
+    } else if (key == "busy_timeout" && is_number && number >= 0) {
+        profile.busy_timeout = (int) number;
+    } else if (key == "mmap_size" || key == "cache_size" ||
+               key == "busy_timeout") {
+        std::cerr << "ERROR: '" << value << "' is not a valid value for "
+                  << key << std::endl;
+        throw tm_utils::CommandError();
+    } else {
+        std::cerr << "ERROR: unknown setting '" << key << "'" << std::endl;
+        throw tm_utils::CommandError();
+    }
+}
+
+
+/**
+ * Description: applies the connection profile to the database, the
+ * settings are read from the config file in tm_dir, then overridden
+ * by environment variables. Invalid settings raise an error and exit
+ * @param[in] tm_dir: the directory holding the database and config
+ */
+void tm_db::TMDatabase::apply_profile(const std::string &tm_dir) {
+    ConnProfile profile;
+
+    // Lines of the config are "key = value", blank lines and everything
+    // after a '#' is ignored
+    std::ifstream config;
+    if (!tm_dir.empty()) {
+        config.open(tm_dir + CONFIG_FILE);
+    }
+    std::string line;
+    while (std::getline(config, line)) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            std::cerr << "ERROR: invalid line in " << tm_dir << CONFIG_FILE
+                      << ": '" << line << "'" << std::endl;
+            throw tm_utils::CommandError();
+        }
+        set_profile_field(profile, tm_utils::trim(line.substr(0, eq)),
+                          tm_utils::trim(line.substr(eq + 1)));
+    }
+
+    for (const std::string key : {"journal_mode", "synchronous", "temp_store",
+                                  "mmap_size", "cache_size", "busy_timeout"}) {
+        std::string env_name = "TM_" + key;
+        std::transform(env_name.begin(), env_name.end(), env_name.begin(),
+                       ::toupper);
+        const char *value = getenv(env_name.c_str());
+        if (value != NULL) {
+            set_profile_field(profile, key, value);
+        }
+    }
+
+    // The busy timeout is set first, so that switching the journal mode
+    // waits for other connections rather than failing
+    sqlite3_busy_timeout(this->db_, profile.busy_timeout);
+
+    std::stringstream ss;
+    ss << "PRAGMA journal_mode = " << profile.journal_mode << ";\n"
+       << "PRAGMA synchronous = " << profile.synchronous << ";\n"
+       << "PRAGMA temp_store = " << profile.temp_store << ";\n"
+       << "PRAGMA mmap_size = " << profile.mmap_size << ";\n"
+       << "PRAGMA cache_size = " << profile.cache_size << ";";
+    this->execute_query(ss.str(), NULL, "SQL error applying connection profile");
+}
+
+
+/**
+ * Description: returns a prepared statement for the sql query, if the
+ * query was already prepared, the cached statement is reset and its
+ * bindings are cleared instead of recompiling it
+ * @param[in] sql: the sql query to prepare, parameters should be
+ * bound with sqlite3_bind_* rather than formatted into the string
+ * @return returns a statement that is ready to be bound and stepped
+ */
+sqlite3_stmt* tm_db::TMDatabase::prepare(const std::string &sql) {
+    auto it = this->stmt_cache_.find(sql);
+    if (it != this->stmt_cache_.end()) {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(this->db_, sql.c_str(), -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        std::cerr << "SQL error preparing statement: "
+                  << sqlite3_errmsg(this->db_) << std::endl;
+        throw tm_utils::CommandError();
+    }
+    this->stmt_cache_[sql] = stmt;
+    return stmt;
+}
+
+
+/**
+ * Description: steps through a prepared statement, and calls callback
+ * on every row returned in the same manner as sqlite3_exec, the
+ * statement is reset once all the rows have been processed
+ * @param[in] stmt: a statement returned by prepare
+ * @param[in] callback: the callback for each row, can be NULL
+ * @param[in] data: passed as the first argument to the callback
+ * @param[in] err_message: the message to display if there is an error
+ *     while stepping through the statement
+ * @param[in] header: printed to stdout right before the first row,
+ *     nothing is printed if the statement returns no rows
+ * @return returns the number of rows returned by the statement
+ */
+int tm_db::TMDatabase::execute_stmt(sqlite3_stmt *stmt,
+                                    const sqlite3_callback callback,
+                                    void *data,
+                                    const std::string &err_message,
+                                    const std::string &header) {
+    int argc = sqlite3_column_count(stmt);
+    std::vector<char*> argv(argc), cols(argc);
+    for (int i = 0; i < argc; ++i) {
+        cols[i] = const_cast<char*>(sqlite3_column_name(stmt, i));
+    }
+
+    int num_rows = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (num_rows++ == 0 && !header.empty()) {
+            std::cout << header;
+        }
+        if (callback == NULL) {
+            continue;
+        }
+        for (int i = 0; i < argc; ++i) {
+            argv[i] = (char*) sqlite3_column_text(stmt, i);
+        }
+        callback(data, argc, argv.data(), cols.data());
+    }
+    if (rc != SQLITE_DONE) {
+        std::cerr << err_message << ": " << sqlite3_errmsg(this->db_)
+                  << std::endl;
+        sqlite3_reset(stmt);
+        throw tm_utils::CommandError();
+    }
+    sqlite3_reset(stmt);
+    return num_rows;
+}
+
+
 /**
  * Executes a sql query
  * @param[in] query: a string containing the query to be run, must be
@@ -67,7 +341,7 @@ void tm_db::TMDatabase::execute_query(const std::string &query,
     if(rc != SQLITE_OK){
         std::cerr << err_message << ": " << err << std::endl;
         sqlite3_free(err);
-        exit(1);
+        throw tm_utils::CommandError();
     }
 }
 
@@ -106,7 +380,7 @@ int tm_db::TMDatabase::num_rows(const std::string &table){
         std::cerr << "ERROR Reading the number of rows from table '"
                   << table << "': " << err_message<< std::endl;
         sqlite3_free(err_message);
-        exit(1);
+        throw tm_utils::CommandError();
     }
     return num_rows;
 }
@@ -119,8 +393,7 @@ int tm_db::TMDatabase::num_rows(const std::string &table){
  * @return returns an int of the id of the tag found in the tags table
  */
 int tm_db::TMDatabase::tag_id(const std::string &tag) {
-    sqlite3_stmt* sql;
-    sqlite3_prepare_v2(this->db_, "SELECT id FROM tags WHERE name = ?1", -1, &sql, NULL);
+    sqlite3_stmt* sql = this->prepare("SELECT id FROM tags WHERE name = ?1");
     sqlite3_bind_text(sql, 1, tag.c_str(), -1, SQLITE_STATIC);
 
     int tag_id = -1;
@@ -129,6 +402,7 @@ int tm_db::TMDatabase::tag_id(const std::string &tag) {
     while ((rc = sqlite3_step(sql)) == SQLITE_ROW) {
         tag_id = sqlite3_column_int(sql, 0);
     }
+    sqlite3_reset(sql);
     return tag_id;
 }
 
@@ -140,16 +414,16 @@ int tm_db::TMDatabase::tag_id(const std::string &tag) {
  * @return returns an int of the id of the tag found in the task table
  */
 int tm_db::TMDatabase::task_id(const std::string &task_name) {
-    sqlite3_stmt* sql;
-    sqlite3_prepare_v2(this->db_, "SELECT id FROM tasks WHERE task = ?1", -1, &sql, NULL);
+    sqlite3_stmt* sql = this->prepare("SELECT id FROM tasks WHERE task = ?1");
     sqlite3_bind_text(sql, 1, task_name.c_str(), -1, SQLITE_STATIC);
 
     int task_id = -1;
     int rc;
-    // On paper, this should only loop once since tag names should be unique
-    while ( (rc = sqlite3_step(sql)) == SQLITE_ROW) {
+    // On paper, this should only loop once since task names should be unique
+    while ((rc = sqlite3_step(sql)) == SQLITE_ROW) {
         task_id = sqlite3_column_int(sql, 0);
     }
+    sqlite3_reset(sql);
     return task_id;
 }
 
@@ -161,16 +435,16 @@ int tm_db::TMDatabase::task_id(const std::string &task_name) {
  * @return returns an int of the id of the proj found in the tags table
  */
 int tm_db::TMDatabase::proj_id(const std::string &proj_name) {
-    sqlite3_stmt* sql;
-    sqlite3_prepare_v2(this->db_, "SELECT id FROM projects WHERE name = ?1", -1, &sql, NULL);
+    sqlite3_stmt* sql = this->prepare("SELECT id FROM projects WHERE name = ?1");
     sqlite3_bind_text(sql, 1, proj_name.c_str(), -1, SQLITE_STATIC);
 
     int proj_id = -1;
     int rc;
-    // On paper, this should only loop once since tag names should be unique
-    while ( (rc = sqlite3_step(sql)) == SQLITE_ROW) {
+    // On paper, this should only loop once since proj names should be unique
+    while ((rc = sqlite3_step(sql)) == SQLITE_ROW) {
         proj_id = sqlite3_column_int(sql, 0);
     }
+    sqlite3_reset(sql);
     return proj_id;
 }
 
@@ -203,6 +477,8 @@ void tm_db::TMDatabase::create_tag_table() {
  *   due: a string containing the date as a string in the following format:
  *   YYYY-MM-DD HH:MM:SS.SSS
  *   complete: boolean for whether a certain task is complete
+ * This is the original layout, migrate_schema changes due and time_done
+ * to seconds since the epoch
  */
 void tm_db::TMDatabase::create_task_table() {
     const std::string sql = "CREATE TABLE IF NOT EXISTS tasks (\n"
@@ -227,6 +503,8 @@ void tm_db::TMDatabase::create_task_table() {
  *   YYYY-MM-DD HH:MM:SS.SSS
  *  length: integer representing the number of seconds the sess lasted
  *  desc: a small description of the session
+ * This is the original layout, migrate_schema changes task_id to an integer
+ * and time_started to seconds since the epoch
  */
 void tm_db::TMDatabase::create_sess_table() {
     const std::string sql = "CREATE TABLE IF NOT EXISTS sess (\n"
@@ -273,23 +551,330 @@ void tm_db::TMDatabase::create_task_tag_table() {
 }
 
 
+/**
+ * Creates the indexes used by the queries on the tables:
+ *   tasks(complete, due): listing tasks filtered on completion, ordered by due
+ *   tasks(proj_id): the tasks of a project
+ *   tasks(time_done): tasks completed over a range of dates
+ *   task_tags(task_id): the tags of a task, the primary key starts with tag_id
+ *   sess(task_id, length): time worked on a task, without reading sess rows
+ *   sess(time_started, length): time worked over a range of dates, and the
+ *       log ordered by date
+ *   sess(time_started / 86400, length): time worked per day
+ */
+void tm_db::TMDatabase::create_indexes() {
+    const std::string sql =
+            "CREATE INDEX IF NOT EXISTS tasks_complete_due "
+            "ON tasks(complete, due);\n"
+            "CREATE INDEX IF NOT EXISTS tasks_proj_id ON tasks(proj_id);\n"
+            "CREATE INDEX IF NOT EXISTS tasks_time_done "
+            "ON tasks(time_done);\n"
+            "CREATE INDEX IF NOT EXISTS task_tags_task_id "
+            "ON task_tags(task_id);\n"
+            "CREATE INDEX IF NOT EXISTS sess_task_id "
+            "ON sess(task_id, length);\n"
+            "CREATE INDEX IF NOT EXISTS sess_time_started "
+            "ON sess(time_started, length);\n"
+            "CREATE INDEX IF NOT EXISTS sess_day "
+            "ON sess(time_started / 86400, length);";
+    this->execute_query(sql, NULL, "SQL error creating indexes");
+}
+
+
+/**
+ * Creates the daily_totals table, which holds the seconds worked and the
+ * number of sessions for every day and task, along with the project of the
+ * task. The triggers that keep it in sync with the sess and tasks tables are
+ * created with it, so every change to a session updates a single row of
+ * daily_totals. Sessions without a task are counted under task_id 0
+ */
+void tm_db::TMDatabase::create_rollup() {
+    const std::string sql = "CREATE TABLE IF NOT EXISTS daily_totals (\n"
+            "\tday       INTEGER NOT NULL,\n"
+            "\ttask_id   INTEGER NOT NULL,\n"
+            "\tproj_id   INTEGER DEFAULT NULL,\n"
+            "\tseconds   INTEGER NOT NULL,\n"
+            "\tsessions  INTEGER NOT NULL,\n"
+            "PRIMARY KEY (day, task_id)\n"
+            ") WITHOUT ROWID;\n"
+            "CREATE TRIGGER IF NOT EXISTS daily_totals_insert\n"
+            "AFTER INSERT ON sess BEGIN\n"
+            " INSERT INTO daily_totals "
+            "(day, task_id, proj_id, seconds, sessions)\n"
+            " VALUES (NEW.time_started / 86400, IFNULL(NEW.task_id, 0),\n"
+            "  (SELECT proj_id FROM tasks WHERE id = NEW.task_id), "
+            "NEW.length, 1)\n"
+            " ON CONFLICT (day, task_id) DO UPDATE\n"
+            " SET seconds = seconds + excluded.seconds, "
+            "sessions = sessions + 1;\n"
+            "END;\n"
+            "CREATE TRIGGER IF NOT EXISTS daily_totals_delete\n"
+            "AFTER DELETE ON sess BEGIN\n"
+            " UPDATE daily_totals\n"
+            " SET seconds = seconds - OLD.length, sessions = sessions - 1\n"
+            " WHERE day = OLD.time_started / 86400\n"
+            " AND task_id = IFNULL(OLD.task_id, 0);\n"
+            " DELETE FROM daily_totals WHERE sessions <= 0\n"
+            " AND day = OLD.time_started / 86400\n"
+            " AND task_id = IFNULL(OLD.task_id, 0);\n"
+            "END;\n"
+            // An update is applied as removing the old session and adding
+            // the new one, which might belong to another day or task
+            "CREATE TRIGGER IF NOT EXISTS daily_totals_update\n"
+            "AFTER UPDATE OF task_id, time_started, length ON sess BEGIN\n"
+            " UPDATE daily_totals\n"
+            " SET seconds = seconds - OLD.length, sessions = sessions - 1\n"
+            " WHERE day = OLD.time_started / 86400\n"
+            " AND task_id = IFNULL(OLD.task_id, 0);\n"
+            " DELETE FROM daily_totals WHERE sessions <= 0\n"
+            " AND day = OLD.time_started / 86400\n"
+            " AND task_id = IFNULL(OLD.task_id, 0);\n"
+            " INSERT INTO daily_totals "
+            "(day, task_id, proj_id, seconds, sessions)\n"
+            " VALUES (NEW.time_started / 86400, IFNULL(NEW.task_id, 0),\n"
+            "  (SELECT proj_id FROM tasks WHERE id = NEW.task_id), "
+            "NEW.length, 1)\n"
+            " ON CONFLICT (day, task_id) DO UPDATE\n"
+            " SET seconds = seconds + excluded.seconds, "
+            "sessions = sessions + 1;\n"
+            "END;\n"
+            "CREATE TRIGGER IF NOT EXISTS daily_totals_task_proj\n"
+            "AFTER UPDATE OF proj_id ON tasks BEGIN\n"
+            " UPDATE daily_totals SET proj_id = NEW.proj_id\n"
+            " WHERE task_id = NEW.id;\n"
+            "END;";
+    this->execute_query(sql, NULL, "SQL error creating daily_totals table");
+}
+
+
+/**
+ * Creates the open_sess table, which holds the sessions that are still
+ * running, their rows in sess are written when they start and their length
+ * is updated as they go
+ * The columns are:
+ *   sess_id: the id of the session in the sess table
+ *   pid: the process running the session
+ * This is the original layout, migrate_schema adds the planned length and
+ * the maximum length of the session
+ */
+void tm_db::TMDatabase::create_open_sess_table() {
+    const std::string sql = "CREATE TABLE IF NOT EXISTS open_sess (\n"
+            "\tsess_id   INTEGER PRIMARY KEY NOT NULL,\n"
+            "\tpid       INTEGER NOT NULL,\n"
+            "FOREIGN KEY (sess_id) REFERENCES sess(id)\n"
+            ");";
+    this->execute_query(sql, NULL, "SQL error creating open_sess table");
+}
+
+
+/**
+ * Description: recomputes the daily_totals table from every session, only
+ * needed if the sess table was modified while the triggers that maintain
+ * daily_totals were missing. Should be called inside of a transaction
+ */
+void tm_db::TMDatabase::rebuild_rollup() {
+    const std::string sql = "DELETE FROM daily_totals;\n"
+            "INSERT INTO daily_totals "
+            "(day, task_id, proj_id, seconds, sessions)\n"
+            "SELECT sess.time_started / 86400, IFNULL(sess.task_id, 0), "
+            "tasks.proj_id,\n"
+            "SUM(sess.length), COUNT(*) FROM sess\n"
+            "LEFT JOIN tasks ON tasks.id = sess.task_id\n"
+            "GROUP BY sess.time_started / 86400, IFNULL(sess.task_id, 0);";
+    this->execute_query(sql, NULL, "SQL error rebuilding daily_totals");
+}
+
+
+/**
+ * Description: gets the id of the last session and the number of sessions,
+ * one of which changes whenever sessions are added or removed, so together
+ * they identify the current set of sessions
+ * @param[out] last_id: the largest session id, 0 if there are none
+ * @param[out] num_sess: the number of sessions
+ */
+void tm_db::TMDatabase::last_sess(int &last_id, int &num_sess) {
+    sqlite3_stmt *stmt = this->prepare(
+            "SELECT IFNULL(MAX(id), 0), COUNT(*) FROM sess");
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        std::cerr << "SQL error querying sessions: "
+                  << sqlite3_errmsg(this->db_) << std::endl;
+        throw tm_utils::CommandError();
+    }
+    last_id = sqlite3_column_int(stmt, 0);
+    num_sess = sqlite3_column_int(stmt, 1);
+    sqlite3_reset(stmt);
+}
+
+
+/**
+ * Description: refreshes the statistics that the query planner uses to pick
+ * indexes, should be run after the database has grown substantially
+ */
+void tm_db::TMDatabase::analyze() {
+    this->execute_query("ANALYZE", NULL, "SQL error analyzing database");
+}
+
+
+/**
+ * Description: brings the schema of the database up to SCHEMA_VERSION, each
+ * migration is applied in order inside of a single transaction, and the new
+ * version is recorded in PRAGMA user_version so that this only does work
+ * once per database
+ */
+void tm_db::TMDatabase::migrate_schema() {
+    int version = 0;
+    sqlite3_stmt *stmt = this->prepare("PRAGMA user_version");
+    this->execute_stmt(stmt, count_callback, &version,
+                       "SQL error reading schema version");
+    if (version >= SCHEMA_VERSION) {
+        return;
+    }
+
+    // Take the write lock before checking again, another tm process
+    // might have migrated the database in the meantime
+    this->execute_query("BEGIN IMMEDIATE", NULL,
+                        "SQL error starting schema migration");
+    this->execute_stmt(stmt, count_callback, &version,
+                       "SQL error reading schema version");
+
+    // Version 1: the original tables, databases created before the schema
+    // was versioned already have these, hence the IF NOT EXISTS
+    if (version < 1) {
+        this->create_tag_table();
+        this->create_task_table();
+        this->create_sess_table();
+        this->create_proj_table();
+        this->create_task_tag_table();
+    }
+
+    // Version 2: sess.task_id was declared as VARCHAR, so the ids were
+    // stored as text, and no index on it could be used when comparing it
+    // with tasks.id. The table is rebuilt with an INTEGER task_id
+    if (version < 2) {
+        const std::string sql = "CREATE TABLE sess_v2 (\n"
+                "\tid                INTEGER PRIMARY KEY NOT NULL,\n"
+                "\ttask_id           INTEGER,\n"
+                "\ttime_started      TEXT,\n"
+                "\tlength            INTEGER NOT NULL,\n"
+                "\tdesc              TEXT DEFAULT NULL,\n"
+                "FOREIGN KEY (task_id) REFERENCES tasks(id)\n"
+                ");\n"
+                "INSERT INTO sess_v2 (id, task_id, time_started, length, desc)\n"
+                "SELECT id, CAST(task_id AS INTEGER), time_started, length, desc\n"
+                "FROM sess;\n"
+                "DROP TABLE sess;\n"
+                "ALTER TABLE sess_v2 RENAME TO sess;";
+        this->execute_query(sql, NULL, "SQL error migrating sess table");
+    }
+
+    // Version 3: dates were stored as 'YYYY-MM-DD HH:MM:SS.SSS' strings,
+    // which had to be parsed for every row that was filtered or grouped by
+    // date. They are now stored as seconds since the epoch, see
+    // tm_utils::to_epoch, and the tasks_iso and sess_iso views show the
+    // tables with their dates in the old format
+    if (version < 3) {
+        const std::string sql = "CREATE TABLE tasks_v3 (\n"
+                "\tid        INTEGER PRIMARY KEY NOT NULL,\n"
+                "\ttask      VARCHAR(128),\n"
+                "\tproj_id   INTEGER DEFAULT NULL,\n"
+                "\tcomplete  INTEGER DEFAULT 0 NOT NULL,\n"
+                "\tdue       INTEGER,\n"
+                "\ttime_done INTEGER DEFAULT NULL,\n"
+                "FOREIGN KEY (proj_id) REFERENCES projects(id)\n"
+                ");\n"
+                "INSERT INTO tasks_v3 (id, task, proj_id, complete, due, "
+                "time_done)\n"
+                "SELECT id, task, proj_id, complete, "
+                "CAST(strftime('%s', due) AS INTEGER),\n"
+                "CAST(strftime('%s', time_done) AS INTEGER) FROM tasks;\n"
+                "DROP TABLE tasks;\n"
+                "ALTER TABLE tasks_v3 RENAME TO tasks;\n"
+                "CREATE TABLE sess_v3 (\n"
+                "\tid                INTEGER PRIMARY KEY NOT NULL,\n"
+                "\ttask_id           INTEGER,\n"
+                "\ttime_started      INTEGER,\n"
+                "\tlength            INTEGER NOT NULL,\n"
+                "\tdesc              TEXT DEFAULT NULL,\n"
+                "FOREIGN KEY (task_id) REFERENCES tasks(id)\n"
+                ");\n"
+                "INSERT INTO sess_v3 (id, task_id, time_started, length, desc)\n"
+                "SELECT id, task_id, CAST(strftime('%s', time_started) AS "
+                "INTEGER),\nlength, desc FROM sess;\n"
+                "DROP TABLE sess;\n"
+                "ALTER TABLE sess_v3 RENAME TO sess;\n"
+                "CREATE VIEW tasks_iso AS\n"
+                "SELECT id, task, proj_id, complete,\n"
+                "strftime('%Y-%m-%d %H:%M:%f', due, 'unixepoch') AS due,\n"
+                "strftime('%Y-%m-%d %H:%M:%f', time_done, 'unixepoch') "
+                "AS time_done\n"
+                "FROM tasks;\n"
+                "CREATE VIEW sess_iso AS\n"
+                "SELECT id, task_id,\n"
+                "strftime('%Y-%m-%d %H:%M:%f', time_started, 'unixepoch') "
+                "AS time_started,\n"
+                "length, desc FROM sess;";
+        this->execute_query(sql, NULL, "SQL error migrating dates to integers");
+    }
+
+    // Version 4: the time worked per day and task is kept in daily_totals,
+    // so that stats don't need to read every session
+    if (version < 4) {
+        this->create_rollup();
+        this->rebuild_rollup();
+    }
+
+    // Version 5: tasks.time_done is indexed for the stats on completed
+    // tasks, the index is added by create_indexes below
+
+    // Version 6: sessions are written when they start rather than when they
+    // end, open_sess tracks the ones that haven't ended yet
+    if (version < 6) {
+        this->create_open_sess_table();
+    }
+
+    // Version 7: sessions can be detached from any process, so open_sess
+    // holds how long they last, and a pid of 0 marks them as detached
+    if (version < 7) {
+        const std::string sql = "ALTER TABLE open_sess "
+                "ADD COLUMN length INTEGER DEFAULT NULL;\n"
+                "ALTER TABLE open_sess "
+                "ADD COLUMN max_length INTEGER DEFAULT NULL;";
+        this->execute_query(sql, NULL, "SQL error migrating open_sess table");
+    }
+
+    // Version 8: a pid only identifies a process on its own host, and only
+    // until it is reused, so open_sess also holds the host of the session,
+    // whose process holds a lock for as long as it runs
+    if (version < 8) {
+        this->execute_query("ALTER TABLE open_sess "
+                            "ADD COLUMN host TEXT DEFAULT NULL;", NULL,
+                            "SQL error migrating open_sess table");
+    }
+
+    // Rebuilding a table drops its indexes, so they are created once all the
+    // tables are in their final shape
+    this->create_indexes();
+
+    std::stringstream ss;
+    ss << "PRAGMA user_version = " << SCHEMA_VERSION;
+    this->execute_query(ss.str(), NULL, "SQL error updating schema version");
+    this->execute_query("COMMIT", NULL, "SQL error committing schema migration");
+}
+
+
 /**
  * Inserts a tag into the tags table, if tag already exists, the color is
  * updated to reflect the new color selected
  * @param[in] tag: the tag to be inserted
  */
 void tm_db::TMDatabase::insert_tag(const Tag &tag) {
-    this->create_tag_table();
-
-    // Format the string so that name and color are inserted, but
-    // id is autoincremented, by sqlite
-    std::stringstream ss;
-    ss << "INSERT INTO tags (name, color)\nVALUES ('"
-       << tag.name << "', '" << tag.color << "') "
-       << "ON CONFLICT(name) DO UPDATE SET color = '"
-       << tag.color << "';";
-    std::string sql(ss.str());
-    this->execute_query(sql, NULL, "SQL error inserting tag into table");
+    // name and color are inserted, but id is autoincremented, by sqlite
+    sqlite3_stmt *stmt = this->prepare(
+            "INSERT INTO tags (name, color)\nVALUES (?1, ?2) "
+            "ON CONFLICT(name) DO UPDATE SET color = ?2;");
+    sqlite3_bind_text(stmt, 1, tag.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, tag.color.c_str(), -1, SQLITE_STATIC);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error inserting tag into table");
 }
 
 
@@ -300,9 +885,6 @@ void tm_db::TMDatabase::insert_tag(const Tag &tag) {
  * specified with tm tag rm --hard
  */
 void tm_db::TMDatabase::remove_tag(const std::string &tag, bool hard) {
-    this->create_tag_table();
-    this->create_task_tag_table();
-
     int tag_id = this->tag_id(tag);
 
     // Returns the total number of times that the tag is used by creating a
@@ -325,7 +907,7 @@ void tm_db::TMDatabase::remove_tag(const std::string &tag, bool hard) {
         std::cerr << "ERROR: Cannot remove tag '" << tag
                   << "' because it is currently referenced by "
                   << num_referenced << " tasks."<< std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
 }
 
@@ -367,24 +949,21 @@ static int nocolor_list_tags(void* data, int argc, char** argv, char** cols) {
  * @param[in] max_tags: the maximum number of tags to be displayed
  */
 void tm_db::TMDatabase::list_tags(bool no_color, int max_tags) {
-    this->create_tag_table();
-
     std::stringstream ss;
     ss << "SELECT name, color FROM tags";
     if (max_tags > 0) {
-        ss << " LIMIT " << max_tags;
+        ss << " LIMIT ?1";
     } else if (max_tags < 0) {
         std::cerr << "ERROR: the -m option must recieve a positive value!"
                   << std::endl;
     }
     ss << ";";
-    std::string sql(ss.str());
+    sqlite3_stmt *stmt = this->prepare(ss.str());
+    sqlite3_bind_int(stmt, 1, max_tags);
 
-    // Print the top of the table
-    if (this->num_rows("tags") > 0) {
-        std::string spaces((SPACE_WIDTH - 3), ' ');
-        std::cout << "\033[1;4;49;39mTag" << spaces << "Color\033[0m" << std::endl;
-    }
+    // The top of the table, printed once the first tag is read
+    std::string spaces((SPACE_WIDTH - 3), ' ');
+    std::string header = "\033[1;4;49;39mTag" + spaces + "Color\033[0m\n";
 
     // Select the correct callback
     sqlite3_callback callback;
@@ -393,7 +972,7 @@ void tm_db::TMDatabase::list_tags(bool no_color, int max_tags) {
     } else {
         callback = color_list_tags;
     }
-    this->execute_query(sql, callback, "SQL error querying tags");
+    this->execute_stmt(stmt, callback, NULL, "SQL error querying tags", header);
 }
 
 
@@ -404,9 +983,11 @@ void tm_db::TMDatabase::list_tags(bool no_color, int max_tags) {
  * @return Returns true if the task_id is valid and the task isn't completed
  */
 bool tm_db::TMDatabase::valid_task_id(int task_id) {
-    std::stringstream ss;
-    ss << "(SELECT id FROM tasks WHERE complete = 0 AND id = " << task_id << ")";
-    return this->num_rows(ss.str()) == 1;
+    sqlite3_stmt *stmt = this->prepare(
+            "SELECT id FROM tasks WHERE complete = 0 AND id = ?1");
+    sqlite3_bind_int(stmt, 1, task_id);
+    return this->execute_stmt(stmt, NULL, NULL,
+                              "SQL error querying tasks") == 1;
 }
 
 
@@ -418,18 +999,16 @@ bool tm_db::TMDatabase::valid_task_id(int task_id) {
  *
  */
 void tm_db::TMDatabase::complete_task(int task_id, int val) {
-    this->create_task_table();
-    std::stringstream ss;
-    ss << "UPDATE tasks\nSET complete = " << val;
+    sqlite3_stmt *stmt = this->prepare(
+            "UPDATE tasks\nSET complete = ?1, time_done = ?2\nWHERE id = ?3;");
+    sqlite3_bind_int(stmt, 1, val);
     if (val == 1) {
-        std::string time_now = tm_utils::current_datetime() + ":00.000";
-        ss << ", time_done = '" << time_now <<  "'";
+        sqlite3_bind_int64(stmt, 2, tm_utils::current_epoch());
     } else {
-        ss << ", time_done = NULL";
+        sqlite3_bind_null(stmt, 2);
     }
-    ss << "\nWHERE id = " << task_id << ";";
-    std::string sql(ss.str());
-    this->execute_query(sql, NULL, "SQL error updating task table");
+    sqlite3_bind_int(stmt, 3, task_id);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error updating task table");
 }
 
 
@@ -440,8 +1019,6 @@ void tm_db::TMDatabase::complete_task(int task_id, int val) {
  * sessions
  */
 void tm_db::TMDatabase::remove_task(int task_id, bool hard) {
-    this->create_task_table();
-
     // Returns the total number of times that the tag is used by creating a
     // subquery and treating it as a table
     std::stringstream ref_ss;
@@ -472,7 +1049,7 @@ void tm_db::TMDatabase::remove_task(int task_id, bool hard) {
         }
         std::cerr << "If you really want to remove this task, run: "
                   << "'tm task rm -i " << task_id << " --hard'" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
 }
 
@@ -482,9 +1059,10 @@ void tm_db::TMDatabase::remove_task(int task_id, bool hard) {
  * @param[in] task: the task to be inserted
  */
 void tm_db::TMDatabase::add_task(const Task &task) {
-    this->create_task_table();
-    this->create_task_tag_table();
-    std::stringstream ss;
+    sqlite3_stmt *stmt = this->prepare(
+            "INSERT INTO tasks (task, due, proj_id)\nVALUES(?1, ?2, ?3)");
+    sqlite3_bind_text(stmt, 1, task.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, tm_utils::to_epoch(task.due));
     if (!task.proj_name.empty()) {
 
         int proj_id = this->proj_id(task.proj_name);
@@ -492,47 +1070,49 @@ void tm_db::TMDatabase::add_task(const Task &task) {
             std::cerr << "ERROR: the project specified for task: '"
                       << task.name << "' is invalid" << std::endl;
             std::cerr << "Invalid project: " << task.proj_name << std::endl;
-            exit(1);
+            throw tm_utils::CommandError();
         }
         // Check to make sure that the proj_id is not for a completed project
-        std::stringstream ss_check;
-        ss_check << "(SELECT 1 FROM projects WHERE complete = 0 AND id = " << proj_id << ")";
-        if (this->num_rows(ss_check.str()) == 0) {
+        sqlite3_stmt *check = this->prepare(
+                "SELECT 1 FROM projects WHERE complete = 0 AND id = ?1");
+        sqlite3_bind_int(check, 1, proj_id);
+        if (this->execute_stmt(check, NULL, NULL,
+                               "SQL error querying projects") == 0) {
             std::cerr << "ERROR: '" << task.proj_name << "' is competed!" << std::endl;
             std::cerr << "Run 'tm proj done -r -n " << task.proj_name
                       << "' to set the project to be still in progress" << std::endl;
-            exit(1);
+            throw tm_utils::CommandError();
         }
-        ss << "INSERT INTO tasks (task, due, proj_id)\nVALUES('"
-           << task.name << "', '" << task.due << "', "
-           << proj_id << ") ";
+        sqlite3_bind_int(stmt, 3, proj_id);
     } else {
-        ss << "INSERT INTO tasks (task, due)\nVALUES('"
-           << task.name << "', '" << task.due << "') ";
+        sqlite3_bind_null(stmt, 3);
     }
-    std::string sql(ss.str());
-    this->execute_query(sql, NULL, "SQL error inserting task into table");
+    this->execute_stmt(stmt, NULL, NULL, "SQL error inserting task into table");
 
-    int task_id = this->task_id(task.name);
+    // The id of the row that was just inserted, no need to look it up by name
+    sqlite3_int64 task_id = sqlite3_last_insert_rowid(this->db_);
     int tag_id;
     for (auto tag: task.tags) {
         tag_id = this->tag_id(tag);
         if (tag_id == -1) {
             std::cerr << "ERROR: '" << tag
                       << "' is not a valid tag." << std::endl;
-            exit(1);
+            throw tm_utils::CommandError();
         }
-        std::stringstream ss1;
-        ss1 << "INSERT INTO task_tags (task_id, tag_id) VALUES\n"
-            << "("<< task_id << ", " << tag_id << ");";
-        this->execute_query(ss1.str(), NULL,
-                            "SQL error inserting into task_tag table");
+        sqlite3_stmt *tag_stmt = this->prepare(
+                "INSERT INTO task_tags (task_id, tag_id) VALUES\n(?1, ?2);");
+        sqlite3_bind_int64(tag_stmt, 1, task_id);
+        sqlite3_bind_int(tag_stmt, 2, tag_id);
+        this->execute_stmt(tag_stmt, NULL, NULL,
+                           "SQL error inserting into task_tag table");
     }
 }
 
 
 /**
- * Description: Callback function for tm task list
+ * Description: Callback function for tm task list, data points to the
+ * current time in seconds since the epoch, the due dates of the tasks are
+ * compared against it to highlight the tasks that are overdue
  */
 int static list_tasks_callback(void* data, int argc,
                                char** argv, char** cols) {
@@ -550,11 +1130,11 @@ int static list_tasks_callback(void* data, int argc,
         completed = "\033[31m✖\033[0m";
     }
 
-    std::string date((const char*) argv[2]);
-    date = date.substr(0, 16);
+    long long due = atoll(argv[2]);
+    std::string date = tm_utils::epoch_to_datetime(due);
 
     std::cout << argv[0] << spaces1 << completed << spaces2;
-    if (date < tm_utils::current_datetime()) {
+    if (due < *(long long*) data) {
         // If complete, print date as red, else print it as green
         if (atoi(argv[1])) {
             std::cout << "\033[92m";
@@ -571,36 +1151,39 @@ int static list_tasks_callback(void* data, int argc,
 }
 
 
+// Separators used by group_concat when the tags of a task are fetched along
+// with the task itself, these are the ASCII unit and record separators, which
+// can't appear in a tag name typed on the command line
+#define TAG_FIELD_SEP '\x1f'
+#define TAG_RECORD_SEP '\x1e'
+
 /**
- * Description: Callback to display the tags for each task when
- * tm task list --long is called
+ * Description: Displays the tags for each task when tm task list --long is
+ * called
+ * @param[in] tags: the tags of one task, as returned by group_concat, each
+ * tag is a name and color separated by TAG_FIELD_SEP, and the tags are
+ * separated by TAG_RECORD_SEP
  */
-int static task_tag_callback(void* data, int argc,
-                             char** argv, char** cols) {
-    std::string color(argv[1]);
-    std::string code = tm_color::COLOR_CODES.find(color)->second;
-
-    std::cout << code << argv[0] << "\033[0m, " << std::flush;
-    return 0;
+static void print_task_tags(const char *tags) {
+    std::cout << "\033[1;39mTags: \033[0m";
+    std::stringstream ss(tags);
+    std::string record;
+    while (std::getline(ss, record, TAG_RECORD_SEP)) {
+        size_t sep = record.find(TAG_FIELD_SEP);
+        std::string color = record.substr(sep + 1);
+        std::string code = tm_color::COLOR_CODES.find(color)->second;
+        std::cout << code << record.substr(0, sep) << "\033[0m, ";
+    }
+    std::cout << std::endl;
 }
 
 /**
- * Description: Callback function for list_tags, unfortunantly, because the
- * method has to be static, a new pointer must be created to the directory to
- * query each of the tags for each of the tasks, because of this, this is one
- * of the most costly operations of tm
+ * Description: Callback function for tm task list --long, the time worked
+ * and the tags of each task are fetched in the same row as the task, so
+ * this doesn't need to query the database again
  */
 int static list_tasks_callback_long(void* data, int argc,
                                     char** argv, char** cols) {
-    std::string homedir = tm_utils::home_dir();
-    std::string db_file = homedir + TM_DIR + DB_FILE;
-    sqlite3 *db;
-    int exit_code = sqlite3_open(db_file.c_str(), &db);
-    if (exit_code) {
-        std::cerr << "Error opening database "
-                  << sqlite3_errmsg(db) << std::endl;
-        exit(1);
-    }
     list_tasks_callback(data, argc, argv, cols);
 
     std::cout << "\033[1;39mTime Worked: \033[0m";
@@ -616,58 +1199,14 @@ int static list_tasks_callback_long(void* data, int argc,
     }
 
     if (argv[6]) {
-        std::string done(argv[6]);
-        std::cout << "\033[1;39mCompleted at: \033[0m" << done.substr(0, 16)
-                  << std::endl;
+        std::cout << "\033[1;39mCompleted at: \033[0m"
+                  << tm_utils::epoch_to_datetime(atoll(argv[6])) << std::endl;
     }
 
-    /**
-     * Here is the query in a more legible fashion, essentially
-     * get all the tag components relating to this specific task
-     *
-     * SELECT
-     *      tags.name,
-     *      tags.color,
-     * FROM tags
-     * INNER JOIN task_tags ON task_tags.tag_id = tags.id
-     * INNER JOIN tasks ON task_tags.task_id = tasks.id
-     * WHERE tasks.name = 'argv[3]'
-     */
-    std::stringstream ss1;
-    ss1 << "SELECT name, color\nFROM tags\n"
-        << "INNER JOIN task_tags ON task_tags.tag_id = tags.id\n"
-        << "INNER JOIN tasks ON task_tags.task_id = tasks.id\n"
-        << "WHERE tasks.task = '" << argv[3] << "'";
-
-    int num_rows = -1;
-
-    std::stringstream ss;
-    ss << "SELECT COUNT(*) FROM (" << ss1.str() << ")";
-
-    char* err_message;
-    int rc = sqlite3_exec(db, ss.str().c_str(),
-                          count_callback, &num_rows, &err_message);
-    if(rc != SQLITE_OK){
-        std::cerr << "ERROR getting the number of tags related to task'"
-                  "\nSQL ERROR: " << err_message << std::endl;
-        sqlite3_free(err_message);
-        exit(1);
-    }
-
-    if (num_rows > 0) {
-        std::cout << "\033[1;39mTags: \033[0m";
-        char* err = NULL;
-        rc = sqlite3_exec(db, ss1.str().c_str(),
-                              task_tag_callback, 0, &err);
-        if(rc != SQLITE_OK){
-            std::cerr << "Error getting tags: " << err << std::endl;
-            sqlite3_free(err);
-            exit(1);
-        }
-        std::cout << std::endl;
+    if (argv[7]) {
+        print_task_tags(argv[7]);
     }
     std::cout << std::endl;
-    sqlite3_close(db);
     return 0;
 }
 
@@ -695,66 +1234,68 @@ void tm_db::TMDatabase::list_tasks(bool list_long, int max_tasks,
                                    const std::string &date_from,
                                    const std::string &date_till,
                                    const std::string &specified_proj) {
-    this->create_task_table();
-
     std::stringstream ss;
     if (list_long) {
-        this->create_proj_table();
-        this->create_sess_table();
-
-        ss << "SELECT DISTINCT tasks.id, tasks.complete, tasks.due, tasks.task, "
-           << "projects.name, SUM(sess.length), tasks.time_done FROM tasks\n"
-           << "LEFT JOIN projects ON tasks.proj_id = projects.id\n"
-           << "LEFT JOIN sess ON sess.task_id = tasks.id\n";
+        // The time worked and the tags are correlated subqueries, so
+        // everything about a task comes back in a single row
+        ss << "SELECT tasks.id, tasks.complete, tasks.due, tasks.task, "
+           << "projects.name,\n"
+           << "(SELECT SUM(length) FROM sess WHERE sess.task_id = tasks.id), "
+           << "tasks.time_done,\n"
+           << "(SELECT group_concat(tags.name || char(31) || tags.color, "
+           << "char(30)) FROM task_tags\n"
+           << " INNER JOIN tags ON task_tags.tag_id = tags.id\n"
+           << " WHERE task_tags.task_id = tasks.id)\n"
+           << "FROM tasks\n"
+           << "LEFT JOIN projects ON tasks.proj_id = projects.id\n";
     } else {
-        ss << "SELECT DISTINCT tasks.id, tasks.complete, tasks.due, "
+        ss << "SELECT tasks.id, tasks.complete, tasks.due, "
            << "tasks.task FROM tasks\n";
     }
-    if (!specified_tags.empty()) {
-        ss << "LEFT JOIN task_tags ON tasks.id = task_tags.task_id\n";
-    }
     ss << "WHERE 1 = 1\n";
     if (!display_done) {
         ss << "AND tasks.complete = 0\n";
     }
+    // The dates are bound as the seconds at the start of each day, so every
+    // filter is a range over the integers in tasks.due
     if (!specified_date.empty()) {
-        ss << "AND date(tasks.due) = date('" << specified_date << "')\n";
+        ss << "AND tasks.due >= :date AND tasks.due < :date + 86400\n";
     }
     if (!date_from.empty()) {
-        ss << "AND date(tasks.due) >= date('" << date_from << "')\n";
+        ss << "AND tasks.due >= :from\n";
     }
     if (!date_till.empty()) {
-        ss << "AND date(tasks.due) <= date('" << date_till << "')\n";
+        ss << "AND tasks.due < :till + 86400\n";
     }
+    int proj_id = -1;
     if (!specified_proj.empty()) {
-        int proj_id = this->proj_id(specified_proj);
+        proj_id = this->proj_id(specified_proj);
         if (proj_id == -1) {
             std::cerr << "ERROR: '" << specified_proj
                       << "' is not an existing project!" << std::endl;
-            exit(1);
+            throw tm_utils::CommandError();
         }
-        ss << "AND tasks.proj_id = " << proj_id << "\n";
+        ss << "AND tasks.proj_id = :proj\n";
     }
+    std::vector<int> tag_ids;
     if (!specified_tags.empty()) {
-        ss << "AND (";
+        ss << "AND tasks.id IN (SELECT task_id FROM task_tags WHERE";
         for (int i = 0; i < specified_tags.size(); ++i) {
             auto tag = specified_tags[i];
             int tag_id = this->tag_id(tag);
             if (tag_id == -1) {
                 std::cerr << "ERROR: '" << tag << "' is an invalid tag"
                           << std::endl;
-                exit(1);
+                throw tm_utils::CommandError();
             }
             if (i != 0) {
                 ss << " OR";
             }
-            ss << " task_tags.tag_id = " << tag_id;
+            ss << " tag_id = :tag" << i;
+            tag_ids.push_back(tag_id);
         }
         ss << ")\n";
     }
-    if (list_long) {
-        ss << "GROUP BY tasks.id\n";
-    }
     if (reversed) {
         ss << "ORDER BY due ASC\n";
     } else {
@@ -762,24 +1303,43 @@ void tm_db::TMDatabase::list_tasks(bool list_long, int max_tasks,
     }
 
     if (max_tasks > 0) {
-        ss << " LIMIT " << max_tasks;
+        ss << " LIMIT :max";
     } else if (max_tasks < 0) {
         std::cerr << "ERROR: the -m option must recieve a positive value!"
                   << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     std::string sql(ss.str());
 
-    int num_tasks = this->num_rows("(" + sql + ")");
-    if (num_tasks == 0) {
-        return;
-    }
+    // The filters are bound rather than formatted into the query, so the
+    // same prepared statement is reused regardless of the values passed in
+    auto bind_date = [](sqlite3_stmt *stmt, const char *name,
+                        const std::string &date) {
+        if (!date.empty()) {
+            sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, name),
+                               tm_utils::to_epoch(date));
+        }
+    };
+    auto bind_filters = [&](sqlite3_stmt *stmt) {
+        bind_date(stmt, ":date", specified_date);
+        bind_date(stmt, ":from", date_from);
+        bind_date(stmt, ":till", date_till);
+        sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":proj"),
+                         proj_id);
+        sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":max"),
+                         max_tasks);
+        for (size_t i = 0; i < tag_ids.size(); ++i) {
+            std::string name = ":tag" + std::to_string(i);
+            sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt,
+                             name.c_str()), tag_ids[i]);
+        }
+    };
 
-    // Print the top of the table
+    // The top of the table, printed once the first task is read
     std::string space1(4, ' ');
     std::string space2(6, ' ');
-    std::cout << "\033[1;4;49;39mID    Done" << space1
-              << "Due Date / Time" << space2 << "Task\033[0m" << std::endl;
+    std::string header = "\033[1;4;49;39mID    Done" + space1
+        + "Due Date / Time" + space2 + "Task\033[0m\n";
 
     sqlite3_callback callback;
     if (list_long) {
@@ -787,7 +1347,11 @@ void tm_db::TMDatabase::list_tasks(bool list_long, int max_tasks,
     } else {
         callback = list_tasks_callback;
     }
-    this->execute_query(sql, callback, "SQL error querying tasks");
+    sqlite3_stmt *stmt = this->prepare(sql);
+    bind_filters(stmt);
+    long long now = tm_utils::current_epoch();
+    this->execute_stmt(stmt, callback, &now, "SQL error querying tasks",
+                       header);
 }
 
 
@@ -806,41 +1370,32 @@ static int list_sess(void* data, int argc, char** argv, char** cols) {
 
     std::cout << argv[0] << spaces << argv[1] << spaces1
               << tm_utils::sec_to_time(atoi(argv[2])) << " (H:MM:SS)  "
-              << argv[3] << std::endl;
+              << tm_utils::epoch_to_datetime(atoll(argv[3])).substr(0, 10)
+              << std::endl;
     return 0;
 }
 
 /**
  * Description: Callback function for printing the sessions
- * Note: in this callback, the output is written to SESS_LOG_FILE, and then
- * a function call is made to feed that into the 'less' bash command
+ * Note: in this callback, the output is appended to the buffer that data
+ * points to, which is handed to the pager once all the rows are rendered
  */
 static int list_sess_long(void* data, int argc, char** argv, char** cols) {
-    std::stringstream ss;
-    ss << "\033[1;49;39mSession Number: " << argv[0] << std::endl;
-    ss << tm_color::NOCOLOR;
+    std::ostream &out = *(std::ostream*) data;
+    out << "\033[1;49;39mSession Number: " << argv[0] << '\n';
+    out << tm_color::NOCOLOR;
     // task_id could be NULL
     if (argv[1]) {
-        ss << "Task to Complete: '" << argv[1] << "'" << std::endl;
+        out << "Task to Complete: '" << argv[1] << "'\n";
     }
-    std::string date_time(argv[2]);
-    ss << "Time and Date: " << date_time.substr(0, 16) << std::endl;
-    ss << "Duration: " << tm_utils::sec_to_time(atoi(argv[3]))
-              << " (H:MM:SS)" << std::endl;
+    out << "Time and Date: " << tm_utils::epoch_to_datetime(atoll(argv[2]))
+        << "\nDuration: " << tm_utils::sec_to_time(atoi(argv[3]))
+        << " (H:MM:SS)\n";
     // description could also be null
     if (argv[4]) {
-        ss << "\n    " << argv[4] << std::endl;
-    }
-    ss << std::endl;
-
-#ifndef _WIN32
-    std::string homedir = tm_utils::home_dir();
-    std::string tm_dir = homedir + TM_DIR;
-    std::string sess_log_file = tm_dir + SESS_LOG_FILE;
-    tm_utils::write_to_file(sess_log_file, ss.str());
-#else
-    std::cout << ss;
-#endif
+        out << "\n    " << argv[4] << '\n';
+    }
+    out << '\n';
     return 0;
 }
 
@@ -856,37 +1411,25 @@ static int list_sess_long(void* data, int argc, char** argv, char** cols) {
  */
 void tm_db::TMDatabase::sess_log(bool condensed, int max_sessions,
                                  bool reversed) {
-    this->create_sess_table();
-    this->create_task_table();
-
-    // Only need this if condensed
-    std::string homedir = tm_utils::home_dir();
-    std::string tm_dir = homedir + TM_DIR;
-    std::string sess_log_file = tm_dir + SESS_LOG_FILE;
-
     std::stringstream ss;
     sqlite3_callback callback;
+    std::string header;
+    // Only needed if not condensed, the whole log is rendered in here
+    std::ostringstream log;
     if (condensed) {
-        ss << "SELECT id, task_id, length, date(time_started)\n"
+        ss << "SELECT id, task_id, length, time_started\n"
            << "FROM sess\n";
         callback = list_sess;
 
-        // Print top of the table
-        if (this->num_rows("(" + ss.str() + ")") > 0) {
-            std::string spaces(13, ' ');
-            std::cout << "\033[1;4;49;39mID  Task ID   Length"
-                      << spaces << "Date      \033[0m" << std::endl;
-        }
+        // Top of the table, printed once the first session is read
+        std::string spaces(13, ' ');
+        header = "\033[1;4;49;39mID  Task ID   Length" + spaces
+            + "Date      \033[0m\n";
     } else {
         ss << "SELECT sess.id, tasks.task, sess.time_started, sess.length, "
            << "sess.desc\n"
            << "FROM sess LEFT JOIN tasks ON tasks.id = sess.task_id\n";
         callback = list_sess_long;
-
-        // Remove the sess file if it already exists
-        tm_utils::remove_file(sess_log_file);
-        // Recreate an empty file
-        tm_utils::make_file(sess_log_file);
     }
     if (reversed) {
         ss << "ORDER BY sess.time_started ASC\n";
@@ -895,21 +1438,21 @@ void tm_db::TMDatabase::sess_log(bool condensed, int max_sessions,
     }
 
     if (max_sessions > 0) {
-       ss << "LIMIT " << max_sessions;
+       ss << "LIMIT ?1";
     } else if (max_sessions < 0) {
         std::cerr << "ERROR: the -m option must recieve a positive number!"
                   << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
-    this->execute_query(ss.str(), callback, "SQL ERROR Querying sessions");
-
-#ifndef _WIN32
-    if (this->num_rows("(" + ss.str() + ")") > 0 && !condensed) {
-        // Output the log to the 'less' bash command
-        std::string cmd = "less " + sess_log_file;
-        system(cmd.c_str());
+    sqlite3_stmt *stmt = this->prepare(ss.str());
+    sqlite3_bind_int(stmt, 1, max_sessions);
+    int num_sessions = this->execute_stmt(stmt, callback, &log,
+                                          "SQL ERROR Querying sessions",
+                                          header);
+
+    if (num_sessions > 0 && !condensed) {
+        tm_utils::page_output(log.str());
     }
-#endif
 }
 
 
@@ -924,27 +1467,27 @@ void tm_db::TMDatabase::add_sess(const std::string &start,
                                  int sess_length,
                                  int &task_id,
                                  const std::string &description) {
-    this->create_sess_table();
-
-    std::stringstream ss_check;
-    ss_check << "(SELECT id FROM tasks WHERE id = " << task_id << ")";
-    if (this->num_rows(ss_check.str()) != 1) {
+    sqlite3_stmt *check = this->prepare("SELECT id FROM tasks WHERE id = ?1");
+    sqlite3_bind_int(check, 1, task_id);
+    if (this->execute_stmt(check, NULL, NULL,
+                           "SQL error querying tasks") != 1) {
         std::cerr << "ERROR: '" << task_id
                   << "' is not a valid task id" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
-    std::stringstream ss;
+    sqlite3_stmt *stmt = this->prepare(
+            "INSERT INTO sess (task_id, time_started, desc, length)\n"
+            "VALUES(?1, ?2, ?3, ?4)");
+    sqlite3_bind_int(stmt, 1, task_id);
+    sqlite3_bind_int64(stmt, 2, tm_utils::to_epoch(start));
     if (!description.empty()) {
-        ss << "INSERT INTO sess (task_id, time_started, desc, length)\nVALUES("
-           << task_id << ", '" << start << "', '" << description << "', "
-           << sess_length << ")";
+        sqlite3_bind_text(stmt, 3, description.c_str(), -1, SQLITE_STATIC);
     } else {
-        ss << "INSERT INTO sess (task_id, time_started, length)\nVALUES("
-           << task_id << ", '" << start << "', "
-           << sess_length << ")";
+        sqlite3_bind_null(stmt, 3);
     }
-    std::string sql(ss.str());
-    this->execute_query(sql, NULL, "SQL error inserting sess into table");
+    sqlite3_bind_int(stmt, 4, sess_length);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error inserting sess into table");
+    tm_utils::remove_file(this->tm_dir_ + GRAD_CACHE_FILE);
 }
 
 
@@ -956,6 +1499,268 @@ void tm_db::TMDatabase::remove_sess(int sess_id) {
     std::stringstream ss;
     ss << "DELETE FROM sess WHERE id = " << sess_id << ";";
     this->execute_query(ss.str(), NULL, "SQL error removing sess from table");
+    tm_utils::remove_file(this->tm_dir_ + GRAD_CACHE_FILE);
+}
+
+
+/**
+ * Description: inserts a session that is starting with a length of 0, and
+ * marks it as open until close_sess is called
+ * @param[in] start: the start date of the session in proper ISO format
+ * @param[in] task_id: the task_id of the task being worked on
+ * @param[in] description: a brief description of the sess
+ * @param[in] length: the planned length of the session, in seconds
+ * @param[in] max_length: the length at which the session ends
+ * @param[in] detached: if false, the session is run by this process
+ * @return the id of the session
+ */
+int tm_db::TMDatabase::open_sess(const std::string &start, int task_id,
+                                 const std::string &description, int length,
+                                 int max_length, bool detached) {
+    this->begin_transaction();
+    this->add_sess(start, 0, task_id, description);
+    int sess_id = (int) sqlite3_last_insert_rowid(this->db_);
+    sqlite3_stmt *stmt = this->prepare(
+            "INSERT INTO open_sess (sess_id, pid, length, max_length, host)\n"
+            "VALUES (?1, ?2, ?3, ?4, ?5)");
+    sqlite3_bind_int(stmt, 1, sess_id);
+    sqlite3_bind_int(stmt, 2, detached ? 0 : (int) getpid());
+    sqlite3_bind_int(stmt, 3, length);
+    sqlite3_bind_int(stmt, 4, max_length);
+    std::string host = tm_utils::host_name();
+    if (!detached) {
+        sqlite3_bind_text(stmt, 5, host.c_str(), -1, SQLITE_STATIC);
+    }
+    this->execute_stmt(stmt, NULL, NULL, "SQL error opening sess");
+
+    // Locked before the session is committed, so that no other process can
+    // see the session without its lock
+    std::string lock_file = this->sess_lock(sess_id);
+    if (!detached && !lock_file.empty()) {
+        int fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            this->sess_locks_[sess_id] = fd;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+    this->commit_transaction();
+    return sess_id;
+}
+
+
+/**
+ * Description: gets every session that hasn't ended yet
+ * @return the open sessions, oldest first
+ */
+std::vector<tm_db::OpenSess> tm_db::TMDatabase::open_sessions() {
+    sqlite3_stmt *stmt = this->prepare(
+            "SELECT open_sess.sess_id, IFNULL(sess.task_id, 0), "
+            "open_sess.pid,\n"
+            "IFNULL(sess.time_started, 0), IFNULL(sess.length, 0),\n"
+            "IFNULL(open_sess.length, 0), IFNULL(open_sess.max_length, 0),\n"
+            "IFNULL(open_sess.host, '')\n"
+            "FROM open_sess LEFT JOIN sess ON sess.id = open_sess.sess_id\n"
+            "ORDER BY open_sess.sess_id");
+    std::vector<OpenSess> sessions;
+    int exit_code;
+    while ((exit_code = sqlite3_step(stmt)) == SQLITE_ROW) {
+        OpenSess sess;
+        sess.id = sqlite3_column_int(stmt, 0);
+        sess.task_id = sqlite3_column_int(stmt, 1);
+        sess.pid = sqlite3_column_int(stmt, 2);
+        sess.time_started = sqlite3_column_int64(stmt, 3);
+        sess.saved = sqlite3_column_int(stmt, 4);
+        sess.length = sqlite3_column_int(stmt, 5);
+        sess.max_length = sqlite3_column_int(stmt, 6);
+        sess.host = (const char*) sqlite3_column_text(stmt, 7);
+        sessions.push_back(sess);
+    }
+    sqlite3_reset(stmt);
+    if (exit_code != SQLITE_DONE) {
+        std::cerr << "SQL error querying open sessions: "
+                  << sqlite3_errmsg(this->db_) << std::endl;
+        throw tm_utils::CommandError();
+    }
+    return sessions;
+}
+
+
+/**
+ * Description: changes how long an open session lasts
+ * @param[in] sess_id: the id returned by open_sess
+ * @param[in] length: the planned length of the session, in seconds
+ * @param[in] max_length: the length at which the session ends
+ */
+void tm_db::TMDatabase::extend_sess(int sess_id, int length, int max_length) {
+    sqlite3_stmt *stmt = this->prepare(
+            "UPDATE open_sess SET length = ?2, max_length = ?3\n"
+            "WHERE sess_id = ?1");
+    sqlite3_bind_int(stmt, 1, sess_id);
+    sqlite3_bind_int(stmt, 2, length);
+    sqlite3_bind_int(stmt, 3, max_length);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error extending sess");
+}
+
+
+/**
+ * Description: gets the path of the control socket of a session
+ * @param[in] sess_id: the id of the session
+ * @return the path, or an empty string if the database has no directory to
+ * hold it
+ */
+std::string tm_db::TMDatabase::sess_socket(int sess_id) const {
+    if (this->tm_dir_.empty()) {
+        return "";
+    }
+    return this->tm_dir_ + SESS_SOCKET_PREFIX + std::to_string(sess_id) +
+        SESS_SOCKET_SUFFIX;
+}
+
+
+/**
+ * Description: gets the path of the file locked by the process running a
+ * session
+ * @param[in] sess_id: the id of the session
+ * @return the path, or an empty string if the database has no directory to
+ * hold it
+ */
+std::string tm_db::TMDatabase::sess_lock(int sess_id) const {
+    if (this->tm_dir_.empty()) {
+        return "";
+    }
+    return this->tm_dir_ + SESS_SOCKET_PREFIX + std::to_string(sess_id) +
+        SESS_LOCK_SUFFIX;
+}
+
+
+/**
+ * Description: records the time worked so far in an open session, so that
+ * it isn't lost if the process running the session dies. A single prepared
+ * update, the daily_totals triggers keep the stats in sync with it
+ * @param[in] sess_id: the id returned by open_sess
+ * @param[in] sess_length: the time in seconds worked so far
+ */
+void tm_db::TMDatabase::checkpoint_sess(int sess_id, int sess_length) {
+    sqlite3_stmt *stmt = this->prepare(
+            "UPDATE sess SET length = ?2 WHERE id = ?1");
+    sqlite3_bind_int(stmt, 1, sess_id);
+    sqlite3_bind_int(stmt, 2, sess_length);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error checkpointing sess");
+    tm_utils::remove_file(this->tm_dir_ + GRAD_CACHE_FILE);
+}
+
+
+/**
+ * Description: records the final length of an open session, or removes it,
+ * and marks it as no longer open
+ * @param[in] sess_id: the id returned by open_sess
+ * @param[in] sess_length: the time in seconds of the sess duration
+ * @param[in] keep: if false, the session is removed from the database
+ * @return false if the session was already closed, in which case nothing is
+ * changed
+ */
+bool tm_db::TMDatabase::close_sess(int sess_id, int sess_length, bool keep) {
+    this->begin_transaction();
+    // Closed first, since another process might have recovered it already,
+    // and its final length mustn't be overwritten with a checkpoint
+    sqlite3_stmt *stmt = this->prepare(
+            "DELETE FROM open_sess WHERE sess_id = ?1");
+    sqlite3_bind_int(stmt, 1, sess_id);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error closing sess");
+    bool open = sqlite3_changes(this->db_) > 0;
+    if (open && keep) {
+        this->checkpoint_sess(sess_id, sess_length);
+    } else if (open) {
+        this->remove_sess(sess_id);
+    }
+    this->commit_transaction();
+
+    // The lock is removed along with the session, and the lock of a session
+    // run by a process that is gone is released already
+    std::string lock_file = this->sess_lock(sess_id);
+    if (!lock_file.empty()) {
+        unlink(lock_file.c_str());
+    }
+    auto it = this->sess_locks_.find(sess_id);
+    if (it != this->sess_locks_.end()) {
+        close(it->second);
+        this->sess_locks_.erase(it);
+    }
+    return open;
+}
+
+
+/**
+ * Description: checks if the process running an open session on this host
+ * is gone, it is if nothing holds the lock of the session, or for sessions
+ * without a lock file, if there is no process with the pid of the session
+ * @param[in] sess: the open session
+ */
+bool tm_db::TMDatabase::sess_dead(const OpenSess &sess) {
+    if (this->sess_locks_.count(sess.id)) {
+        return false;
+    }
+    std::string lock_file = this->sess_lock(sess.id);
+    int fd = -1;
+    if (!lock_file.empty()) {
+        fd = open(lock_file.c_str(), O_RDWR | O_CLOEXEC);
+    }
+    if (fd >= 0) {
+        bool locked = flock(fd, LOCK_EX | LOCK_NB) != 0;
+        close(fd);
+        return !locked;
+    }
+    // EPERM means the process exists, but belongs to another user
+    return kill(sess.pid, 0) != 0 && errno == ESRCH;
+}
+
+
+/**
+ * Description: closes the open sessions of processes that are no longer
+ * running on this host, keeping the length of their last checkpoint.
+ * Sessions of other hosts are left to those hosts. Sessions that were
+ * checkpointed at a minute or less are removed, like interrupted sessions
+ * are. Detached sessions are closed at their maximum length once it has
+ * passed
+ */
+void tm_db::TMDatabase::recover_sessions() {
+    long long now = tm_utils::current_epoch();
+    std::string host = tm_utils::host_name();
+    for (auto &sess : this->open_sessions()) {
+        if (sess.pid == 0) {
+            if (now - sess.time_started < sess.max_length) {
+                continue;
+            }
+            if (!this->close_sess(sess.id, sess.max_length, true)) {
+                continue;
+            }
+            std::cerr << "Session " << sess.id << " reached its limit, and"
+                      << " was closed with a duration of: "
+                      << tm_utils::sec_to_time(sess.max_length) << std::endl;
+            continue;
+        }
+
+        if ((!sess.host.empty() && sess.host != host) ||
+                !this->sess_dead(sess)) {
+            continue;
+        }
+        bool keep = sess.saved > 60;
+        if (!this->close_sess(sess.id, sess.saved, keep)) {
+            continue;
+        }
+        // Left behind by the process, remove_file can't open a socket to
+        // check that it exists
+        std::string socket_file = this->sess_socket(sess.id);
+        if (!socket_file.empty()) {
+            unlink(socket_file.c_str());
+        }
+        if (keep) {
+            std::cerr << "Recovered session " << sess.id << ", which was"
+                      << " left open, with a duration of: "
+                      << tm_utils::sec_to_time(sess.saved) << std::endl;
+        }
+    }
 }
 
 
@@ -967,7 +1772,6 @@ void tm_db::TMDatabase::remove_sess(int sess_id) {
  * @return Returns
  */
 void tm_db::TMDatabase::remove_project(std::string proj_name, bool hard) {
-    this->create_proj_table();
     int proj_id = this->proj_id(proj_name);
 
     if (hard) {
@@ -990,12 +1794,11 @@ void tm_db::TMDatabase::remove_project(std::string proj_name, bool hard) {
  * @param[in] val: val will be 1 if project is to be completed, 0 if incomplete
  */
 void tm_db::TMDatabase::complete_project(std::string proj_name, int val) {
-    this->create_proj_table();
     int proj_id = this->proj_id(proj_name);
     if (proj_id == -1) {
         std::cerr << "ERROR: '" << proj_id << "' is not a valid project"
                   << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
 
     std::stringstream ss_num;
@@ -1031,8 +1834,6 @@ void tm_db::TMDatabase::complete_project(std::string proj_name, int val) {
  * @param[in] proj_name: the name of the project to be added
  */
 void tm_db::TMDatabase::add_project(const std::string &proj_name) {
-    this->create_proj_table();
-
     std::stringstream ss;
     ss << "INSERT INTO projects (name)\nVALUES ('" << proj_name << "');";
     std::string sql(ss.str());
@@ -1058,75 +1859,48 @@ int static list_projects_callback(void* data, int argc,
 //
 // Prints the sample tasks from one project
 //
-int static proj_task_callback(void* data, int argc,
-                              char** argv, char** cols) {
-    size_t tag_len = strlen(argv[0]);
+static void print_proj_task(char *id, char *due, char *task) {
+    size_t tag_len = strlen(id);
     std::string spaces((7 - tag_len), ' ');
-    std::string date(argv[1]);
-    std::cout << "\t" << argv[0] << spaces << date.substr(0, 10)
-              << "  " << argv[2] << std::endl;
-    return 0;
+    std::string date = tm_utils::epoch_to_datetime(atoll(due));
+    std::cout << "\t" << id << spaces << date.substr(0, 10)
+              << "  " << task << std::endl;
 }
 
 //
-// callback for tm proj list -l
+// callback for tm proj list -l, each row is a project along with one of its
+// sample tasks, so a project spans up to 5 consecutive rows. data points to
+// the id of the project printed by the previous row
 //
 int static list_projects_callback_long(void* data, int argc,
                                        char** argv, char** cols) {
-    std::string homedir = tm_utils::home_dir();
-    std::string db_file = homedir + TM_DIR + DB_FILE;
-    sqlite3 *db;
-    int exit_code = sqlite3_open(db_file.c_str(), &db);
-    if (exit_code) {
-        std::cerr << "Error opening database "
-                  << sqlite3_errmsg(db) << std::endl;
-        exit(1);
-    }
-    list_projects_callback(data, argc, argv, cols);
-
-    std::cout << "\033[1;39mTime Worked: \033[0m";
-    if (argv[3]) {
-        std::cout << tm_utils::sec_to_time(atoi(argv[3]));
-    } else {
-        std::cout << tm_utils::sec_to_time(0);
-    }
-    std::cout << " (H:MM:SS)"<< std::endl;
-
-    std::stringstream ss1;
-    ss1 << "SELECT id, due, task\nFROM tasks\n"
-        << "WHERE complete = 0 AND proj_id = "
-        << argv[2] << "\nORDER BY due DESC\nLIMIT 5";
+    std::string *prev_id = (std::string*) data;
+    if (*prev_id != argv[2]) {
+        if (!prev_id->empty()) {
+            std::cout << std::endl;
+        }
+        *prev_id = argv[2];
+        list_projects_callback(data, argc, argv, cols);
 
-    int num_rows = -1;
-    std::stringstream ss;
-    ss << "SELECT COUNT(*) FROM (" << ss1.str() << ")";
-    char* err_message;
-    int rc = sqlite3_exec(db, ss.str().c_str(),
-                          count_callback, &num_rows, &err_message);
-    if(rc != SQLITE_OK){
-        std::cerr << "ERROR getting the number of tags related to task'"
-                  "\nSQL ERROR: " << err_message << std::endl;
-        sqlite3_free(err_message);
-        exit(1);
-    }
+        std::cout << "\033[1;39mTime Worked: \033[0m";
+        if (argv[3]) {
+            std::cout << tm_utils::sec_to_time(atoi(argv[3]));
+        } else {
+            std::cout << tm_utils::sec_to_time(0);
+        }
+        std::cout << " (H:MM:SS)"<< std::endl;
 
-    if (num_rows > 0) {
-        std::cout << "\033[1;39mTasks:  \033[0m"
-                  << "\033[1;4;39mID     Due         Task\033[0m"
-                  << std::endl;
-        char* err = NULL;
-        rc = sqlite3_exec(db, ss1.str().c_str(),
-                              proj_task_callback, 0, &err);
-        if(rc != SQLITE_OK){
-            std::cerr << "Error getting tags: " << err << std::endl;
-            sqlite3_free(err);
-            exit(1);
+        if (argv[4]) {
+            std::cout << "\033[1;39mTasks:  \033[0m"
+                      << "\033[1;4;39mID     Due         Task\033[0m"
+                      << std::endl;
+        } else {
+            std::cout << "All tasks completed at this time." << std::endl;
         }
-    } else {
-        std::cout << "All tasks completed at this time." << std::endl;
     }
-    std::cout << std::endl;
-    sqlite3_close(db);
+    if (argv[4]) {
+        print_proj_task(argv[4], argv[5], argv[6]);
+    }
     return 0;
 }
 
@@ -1141,14 +1915,26 @@ int static list_projects_callback_long(void* data, int argc,
  */
 void tm_db::TMDatabase::list_projects(bool show_tasks, bool display_done,
                                       const std::vector<std::string> &projects) {
-    this->create_proj_table();
-
     std::stringstream ss;
     if (show_tasks) {
-        ss << "SELECT projects.complete, projects.name, projects.id, "
-           << "SUM(sess.length) FROM projects\n"
-           << "LEFT JOIN tasks ON tasks.proj_id = projects.id\n"
-           << "LEFT JOIN sess ON sess.task_id = tasks.id\n";
+        // The time worked and the 5 incomplete tasks due last for every
+        // project are computed in the same query, a project with no
+        // incomplete tasks gets a single row with NULL task columns
+        ss << "WITH proj_time AS (\n"
+           << " SELECT tasks.proj_id, SUM(sess.length) AS total FROM sess\n"
+           << " INNER JOIN tasks ON sess.task_id = tasks.id\n"
+           << " GROUP BY tasks.proj_id\n"
+           << "), proj_tasks AS (\n"
+           << " SELECT proj_id, id, due, task, ROW_NUMBER() OVER (\n"
+           << "  PARTITION BY proj_id ORDER BY due DESC) AS num FROM tasks\n"
+           << " WHERE complete = 0 AND proj_id IS NOT NULL\n"
+           << ")\n"
+           << "SELECT projects.complete, projects.name, projects.id, "
+           << "proj_time.total,\n"
+           << "proj_tasks.id, proj_tasks.due, proj_tasks.task FROM projects\n"
+           << "LEFT JOIN proj_time ON proj_time.proj_id = projects.id\n"
+           << "LEFT JOIN proj_tasks ON proj_tasks.proj_id = projects.id\n"
+           << " AND proj_tasks.num <= 5\n";
     } else {
         ss << "SELECT complete, name, id FROM projects\n";
     }
@@ -1157,76 +1943,461 @@ void tm_db::TMDatabase::list_projects(bool show_tasks, bool display_done,
         ss << "AND projects.complete = 0\n";
     }
     if (show_tasks) {
-        ss << "GROUP BY tasks.proj_id\n";
+        ss << "ORDER BY projects.id, proj_tasks.num\n";
     }
-    std::string sql(ss.str());
+    sqlite3_stmt *stmt = this->prepare(ss.str());
 
-    // Print the top of the table
-    if (this->num_rows("(" + sql + ")") > 0) {
-        std::cout << "\033[1;4;49;39mDone    Project\033[0m" << std::endl;
-    }
+    // The top of the table, printed once the first project is read
+    std::string header = "\033[1;4;49;39mDone    Project\033[0m\n";
 
-    // Select the correct callback
-    sqlite3_callback callback;
     if (show_tasks) {
-        callback = list_projects_callback_long;
+        std::string prev_id;
+        this->execute_stmt(stmt, list_projects_callback_long, &prev_id,
+                           "SQL error querying projects", header);
+        if (!prev_id.empty()) {
+            std::cout << std::endl;
+        }
     } else {
-        callback = list_projects_callback;
+        this->execute_stmt(stmt, list_projects_callback, NULL,
+                           "SQL error querying projects", header);
     }
-    this->execute_query(sql, callback, "SQL error querying projects");
 }
 
 
-std::unordered_map<std::string, double> daily_data;
+/**
+ * Description: starts a transaction, or a savepoint if a transaction was
+ * already begun, so that transactions can be nested
+ * @param[in] write: take the write lock immediately so that nothing else can
+ * modify the database until commit_transaction is called
+ * @return the number of transactions that were already begun, to be passed
+ * to rollback_transaction
+ */
+int tm_db::TMDatabase::begin_transaction(bool write) {
+    std::string sql = write ? "BEGIN IMMEDIATE" : "BEGIN";
+    if (this->txn_depth_ > 0) {
+        sql = "SAVEPOINT tm_" + std::to_string(this->txn_depth_);
+    }
+    this->execute_stmt(this->prepare(sql), NULL, NULL,
+                       "SQL error starting transaction");
+    return this->txn_depth_++;
+}
+
+
+/**
+ * Description: commits the innermost transaction started by
+ * begin_transaction, a savepoint is only written once every transaction it
+ * is nested in is committed
+ */
+void tm_db::TMDatabase::commit_transaction() {
+    std::string sql = "COMMIT";
+    if (this->txn_depth_ > 1) {
+        sql = "RELEASE tm_" + std::to_string(this->txn_depth_ - 1);
+    }
+    this->execute_stmt(this->prepare(sql), NULL, NULL,
+                       "SQL error committing transaction");
+    --this->txn_depth_;
+}
+
 
 /**
- * Callback for populating the daily_data map, used primarily for tm stat
- * function calls
+ * Description: undoes every change made since a transaction began, and ends
+ * it along with every transaction nested in it
+ * @param[in] depth: the value returned by the begin_transaction of the
+ * transaction to roll back
+ */
+void tm_db::TMDatabase::rollback_transaction(int depth) {
+    // Rolling back to a savepoint keeps it open, so it is released after
+    this->txn_depth_ = depth;
+    if (depth == 0) {
+        this->execute_stmt(this->prepare("ROLLBACK"), NULL, NULL,
+                           "SQL error rolling back transaction");
+        return;
+    }
+    std::string savepoint = "tm_" + std::to_string(depth);
+    this->execute_stmt(this->prepare("ROLLBACK TO " + savepoint), NULL, NULL,
+                       "SQL error rolling back transaction");
+    this->execute_stmt(this->prepare("RELEASE " + savepoint), NULL, NULL,
+                       "SQL error rolling back transaction");
+}
+
+
+/**
+ * Description: Callback that stores a (name, id) row into the map that
+ * data points to
+ */
+static int fill_id_map(void* data, int argc, char** argv, char** cols) {
+    auto *ids = (std::unordered_map<std::string, int>*) data;
+    if (argv[0]) {
+        (*ids)[argv[0]] = atoi(argv[1]);
+    }
+    return 0;
+}
+
+
+/**
+ * Description: reads the ids of all the tags, projects and tasks
+ * @return Returns the maps from names to ids
+ */
+tm_db::IdMaps tm_db::TMDatabase::load_id_maps() {
+    IdMaps ids;
+    this->execute_stmt(this->prepare("SELECT name, id FROM tags"),
+                       fill_id_map, &ids.tags, "SQL error querying tags");
+    this->execute_stmt(this->prepare("SELECT name, id FROM projects"),
+                       fill_id_map, &ids.projects,
+                       "SQL error querying projects");
+    // Ordered by id so that the most recent task wins for duplicate names
+    this->execute_stmt(this->prepare("SELECT task, id FROM tasks ORDER BY id"),
+                       fill_id_map, &ids.tasks, "SQL error querying tasks");
+    return ids;
+}
+
+
+/**
+ * Description: imports a tag, if the tag already exists its color is
+ * updated. ids is updated with the id of the tag
+ * @param[in] tag: the tag to import
+ * @param[in] ids: the maps returned from load_id_maps
+ */
+void tm_db::TMDatabase::import_tag(const Tag &tag, IdMaps &ids) {
+    auto it = ids.tags.find(tag.name);
+    sqlite3_stmt *stmt;
+    if (it != ids.tags.end()) {
+        stmt = this->prepare("UPDATE tags SET color = ?2 WHERE id = ?1");
+        sqlite3_bind_int(stmt, 1, it->second);
+    } else {
+        stmt = this->prepare("INSERT INTO tags (name, color) VALUES (?1, ?2)");
+        sqlite3_bind_text(stmt, 1, tag.name.c_str(), -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_text(stmt, 2, tag.color.c_str(), -1, SQLITE_STATIC);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error importing tag");
+    if (it == ids.tags.end()) {
+        ids.tags[tag.name] = sqlite3_last_insert_rowid(this->db_);
+    }
+}
+
+
+/**
+ * Description: imports a project, if the project already exists its
+ * completion status is updated. ids is updated with the id of the project
+ * @param[in] proj_name: the name of the project
+ * @param[in] complete: 1 if the project is complete, else 0
+ * @param[in] ids: the maps returned from load_id_maps
+ */
+void tm_db::TMDatabase::import_project(const std::string &proj_name,
+                                       int complete, IdMaps &ids) {
+    auto it = ids.projects.find(proj_name);
+    sqlite3_stmt *stmt;
+    if (it != ids.projects.end()) {
+        stmt = this->prepare("UPDATE projects SET complete = ?2 WHERE id = ?1");
+        sqlite3_bind_int(stmt, 1, it->second);
+    } else {
+        stmt = this->prepare(
+                "INSERT INTO projects (name, complete) VALUES (?1, ?2)");
+        sqlite3_bind_text(stmt, 1, proj_name.c_str(), -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_int(stmt, 2, complete);
+    this->execute_stmt(stmt, NULL, NULL, "SQL error importing project");
+    if (it == ids.projects.end()) {
+        ids.projects[proj_name] = sqlite3_last_insert_rowid(this->db_);
+    }
+}
+
+
+/**
+ * Description: imports a task, its project and tags must already be in ids.
+ * ids is updated with the id of the new task
+ * @param[in] task: the task to import
+ * @param[in] key: the id of the task in the stream, 0 if it has none
+ * @param[in] ids: the maps returned from load_id_maps
+ */
+void tm_db::TMDatabase::import_task(const Task &task, int key, IdMaps &ids) {
+    sqlite3_stmt *stmt = this->prepare(
+            "INSERT INTO tasks (task, due, proj_id, complete, time_done)\n"
+            "VALUES (?1, ?2, ?3, ?4, ?5)");
+    sqlite3_bind_text(stmt, 1, task.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, tm_utils::to_epoch(task.due));
+    if (!task.proj_name.empty()) {
+        sqlite3_bind_int(stmt, 3, ids.projects.at(task.proj_name));
+    }
+    sqlite3_bind_int(stmt, 4, task.complete);
+    if (!task.time_done.empty()) {
+        sqlite3_bind_int64(stmt, 5, tm_utils::to_epoch(task.time_done));
+    }
+    this->execute_stmt(stmt, NULL, NULL, "SQL error importing task");
+
+    int task_id = sqlite3_last_insert_rowid(this->db_);
+    ids.tasks[task.name] = task_id;
+    if (key != 0) {
+        ids.task_keys[key] = task_id;
+    }
+    for (auto const &tag : task.tags) {
+        sqlite3_stmt *tag_stmt = this->prepare(
+                "INSERT OR IGNORE INTO task_tags (task_id, tag_id) "
+                "VALUES (?1, ?2)");
+        sqlite3_bind_int(tag_stmt, 1, task_id);
+        sqlite3_bind_int(tag_stmt, 2, ids.tags.at(tag));
+        this->execute_stmt(tag_stmt, NULL, NULL,
+                           "SQL error importing task tags");
+    }
+}
+
+
+/**
+ * Description: imports a session, its task must already be in ids, or be
+ * empty for sessions that don't reference a task
+ * @param[in] sess: the session to import
+ * @param[in] ids: the maps returned from load_id_maps
+ */
+void tm_db::TMDatabase::import_sess(const Sess &sess, const IdMaps &ids) {
+    sqlite3_stmt *stmt = this->prepare(
+            "INSERT INTO sess (task_id, time_started, length, desc)\n"
+            "VALUES (?1, ?2, ?3, ?4)");
+    if (sess.task_key != 0) {
+        sqlite3_bind_int(stmt, 1, ids.task_keys.at(sess.task_key));
+    } else if (!sess.task_name.empty()) {
+        sqlite3_bind_int(stmt, 1, ids.tasks.at(sess.task_name));
+    }
+    sqlite3_bind_int64(stmt, 2, tm_utils::to_epoch(sess.time_started));
+    sqlite3_bind_int(stmt, 3, sess.length);
+    if (!sess.desc.empty()) {
+        sqlite3_bind_text(stmt, 4, sess.desc.c_str(), -1, SQLITE_STATIC);
+    }
+    this->execute_stmt(stmt, NULL, NULL, "SQL error importing session");
+}
+
+
+/**
+ * Description: reads every tag, project, task and session inside a single
+ * read transaction, one statement per table, and calls callback on each row.
+ * argv[0] of a row is the type of the record ("tag", "proj", "task" or
+ * "sess"), and the rest of the columns are the fields of that record in the
+ * order defined in import.hpp, the tags of a task are separated by the ASCII
+ * unit separator. Sessions that are still open have no final length yet, so
+ * they are left out
+ * @param[in] callback: the callback for each row
+ * @param[in] data: passed as the first argument to the callback
+ */
+void tm_db::TMDatabase::export_records(const sqlite3_callback callback,
+                                       void *data) {
+    const std::vector<std::string> queries = {
+        "SELECT 'tag', name, color FROM tags ORDER BY id",
+        "SELECT 'proj', name, complete FROM projects ORDER BY id",
+        // The tags of all the tasks are grouped in a single pass over
+        // task_tags, rather than being looked up for every task. Tasks and
+        // sessions are read through the views that format their dates
+        "SELECT 'task', tasks.task, projects.name, tasks.due, "
+        "tasks.complete, tasks.time_done, task_tag_names.names, tasks.id\n"
+        "FROM tasks_iso AS tasks\n"
+        "LEFT JOIN projects ON tasks.proj_id = projects.id\n"
+        "LEFT JOIN (SELECT task_tags.task_id, "
+        "group_concat(tags.name, char(31)) AS names FROM task_tags\n"
+        " INNER JOIN tags ON task_tags.tag_id = tags.id\n"
+        " GROUP BY task_tags.task_id) AS task_tag_names\n"
+        " ON task_tag_names.task_id = tasks.id\n"
+        "ORDER BY tasks.id",
+        "SELECT 'sess', tasks.task, sess.time_started, sess.length, sess.desc,"
+        " tasks.id\n"
+        "FROM sess_iso AS sess LEFT JOIN tasks ON tasks.id = sess.task_id\n"
+        "WHERE sess.id NOT IN (SELECT sess_id FROM open_sess)\n"
+        "ORDER BY sess.id"
+    };
+    this->begin_transaction(false);
+    for (auto const &query : queries) {
+        this->execute_stmt(this->prepare(query), callback, data,
+                           "SQL error exporting records");
+    }
+    this->commit_transaction();
+}
+
+
+/**
+ * Description: sets the value of a day, the series grows to include the day
+ * if it is outside of the current range
+ * @param[in] day: the Rata Die day number of the day
+ * @param[in] value: the value of the day
+ */
+void tm_db::DailySeries::set(int day, double value) {
+    if (this->values.empty()) {
+        this->first_day = day;
+    } else if (day < this->first_day) {
+        this->values.insert(this->values.begin(), this->first_day - day, NAN);
+        this->first_day = day;
+    }
+    if (day > this->last_day()) {
+        this->values.resize(day - this->first_day + 1, NAN);
+    }
+    this->values[day - this->first_day] = value;
+}
+
+
+/**
+ * Description: returns the value of a day, or NAN if the day has no data or
+ * is outside of the range of the series
+ * @param[in] day: the Rata Die day number of the day
+ */
+double tm_db::DailySeries::get(int day) const {
+    if (day < this->first_day || day > this->last_day()) {
+        return NAN;
+    }
+    return this->values[day - this->first_day];
+}
+
+
+/**
+ * Callback for populating a DailySeries, used primarily for tm stat function
+ * calls, the rows are the Rata Die of a day and its value, and data points to
+ * the series owned by the caller
  */
 int static fill_daily_data(void* data, int argc,
                            char** argv, char** cols) {
-    std::string date(argv[0]);
-    double amount = atoi(argv[1]);
-    daily_data[date] = amount;
+    auto *series = (tm_db::DailySeries*) data;
+    series->set(atoi(argv[0]), atof(argv[1]));
     return 0;
 }
 
+
 /**
- * Description: Queries the total amount of
+ * Description: binds the range of days of a stat query, as the seconds at
+ * the start of from and at the end of until, an empty date leaves that end
+ * of the range open
+ */
+static void bind_stat_range(sqlite3_stmt *stmt, const std::string &from,
+                            const std::string &until) {
+    sqlite3_bind_int64(stmt, 1, from.empty() ? LLONG_MIN
+                                             : tm_utils::to_epoch(from));
+    sqlite3_bind_int64(stmt, 2, until.empty() ? LLONG_MAX
+                                              : tm_utils::to_epoch(until) + 86399);
+}
+
+
+/**
+ * Description: Queries the total amount of time worked on each day
  * @param[in] from: the starting date to query from, if it is empty, then
  * no restriction is added for the starting date
  * @param[in] until: the end date to query till, if empty no restrictions added
- * @return Returns a mapping from dates -> time worked
+ * @param[out] series: filled with the seconds worked on every day
  */
-std::unordered_map<std::string, double>
-tm_db::TMDatabase::stat_time_query(const std::string &from,
-                                   const std::string &until) {
+void tm_db::TMDatabase::stat_time_query(const std::string &from,
+                                        const std::string &until,
+                                        DailySeries &series) {
+    // The totals are read from daily_totals, which has a row per day and
+    // task, so this reads O(days) rows regardless of the number of sessions
     std::stringstream ss;
-
-    ss << "SELECT date(time_started), SUM(length) FROM sess\n";
-    ss << "WHERE 1 = 1\n";
-    if (!from.empty()) {
-        ss << "AND time_started >= '" << from << "'\n";
-    }
-    if (!until.empty()) {
-        ss << "AND time_started <= '" << until << "'\n";
-    }
-    ss << "GROUP BY date(time_started)";
-    this->execute_query(ss.str(), fill_daily_data,
-            "ERROR: Failed to query sessions");
-    return daily_data;
+    ss << "SELECT day + " << EPOCH_RDN << ", SUM(seconds) FROM daily_totals\n"
+       << "WHERE day >= ?1 / 86400 AND day <= ?2 / 86400\n"
+       << "GROUP BY day";
+    sqlite3_stmt *stmt = this->prepare(ss.str());
+    bind_stat_range(stmt, from, until);
+    this->execute_stmt(stmt, fill_daily_data, &series,
+                       "ERROR: Failed to query sessions");
 }
 
+
 /**
- * Description: Queries the total amount of
+ * Description: Queries the number of tasks completed on each day
  * @param[in] from: the starting date to query from, if it is empty, then
  * no restriction is added for the starting date
  * @param[in] until: the end date to query till, if empty no restrictions added
- * @return Returns a mapping from dates -> time worked
+ * @param[out] series: filled with the tasks completed on every day
+ */
+void tm_db::TMDatabase::stat_task_query(const std::string &from,
+                                        const std::string &until,
+                                        DailySeries &series) {
+    std::stringstream ss;
+    ss << "SELECT time_done / 86400 + " << EPOCH_RDN << ", COUNT(*) "
+       << "FROM tasks\n"
+       << "WHERE complete = 1 AND time_done BETWEEN ?1 AND ?2\n"
+       << "GROUP BY time_done / 86400";
+    sqlite3_stmt *stmt = this->prepare(ss.str());
+    bind_stat_range(stmt, from, until);
+    this->execute_stmt(stmt, fill_daily_data, &series,
+                       "ERROR: Failed to query tasks");
+}
+
+
+/**
+ * Callback for stat_grad_query, the rows are an id, the Rata Die of a day
+ * and its value, and data points to the series of every id
+ */
+int static fill_grad_data(void* data, int argc,
+                          char** argv, char** cols) {
+    auto *series = (std::unordered_map<int, tm_db::DailySeries>*) data;
+    (*series)[argv[0] ? atoi(argv[0]) : 0].set(atoi(argv[1]), atof(argv[2]));
+    return 0;
+}
+
+
+/**
+ * Description: Queries a metric for every day in a range, for a group of
+ * tasks, projects or tags at once, every group is computed in the same pass
+ * over the data
+ * @param[in] metric: "time" for the seconds worked, "sessions" for the number
+ * of sessions, or "tasks-done" for the tasks completed
+ * @param[in] group: "task", "proj" or "tag" to compute the metric separately
+ * for each id in ids, or empty to compute it over all the data, in which case
+ * the series is keyed by 0
+ * @param[in] ids: the ids of the tasks, projects or tags
+ * @param[in] from_day: the Rata Die of the first day to query
+ * @param[in] until_day: the Rata Die of the last day to query
+ * @param[out] series: the value of every day, keyed by id
  */
-std::unordered_map<std::string, double>
-tm_db::TMDatabase::stat_task_query(const std::string &from,
-                                   const std::string &until) {
-    // TODO (21/08/2019): FINISH stat task query
-    return daily_data;
+void tm_db::TMDatabase::stat_grad_query(const std::string &metric,
+        const std::string &group, const std::vector<int> &ids,
+        int from_day, int until_day,
+        std::unordered_map<int, DailySeries> &series) {
+    // Time and sessions are read from daily_totals, which already has the
+    // task and project of every row, completed tasks from the tasks table
+    bool done = metric == "tasks-done";
+    std::string table = done ? "tasks" : "daily_totals";
+    std::string task_col = done ? "tasks.id" : "daily_totals.task_id";
+    std::string day_col = done ? "tasks.time_done / 86400" : "daily_totals.day";
+
+    std::string key_col = "0";
+    if (group == "task") {
+        key_col = task_col;
+    } else if (group == "proj") {
+        key_col = table + ".proj_id";
+    } else if (group == "tag") {
+        key_col = "task_tags.tag_id";
+    }
+
+    std::stringstream ss;
+    ss << "SELECT " << key_col << ", " << day_col << " + " << EPOCH_RDN << ", ";
+    if (done) {
+        ss << "COUNT(*)";
+    } else if (metric == "sessions") {
+        ss << "SUM(daily_totals.sessions)";
+    } else {
+        ss << "SUM(daily_totals.seconds)";
+    }
+    ss << "\nFROM " << table << "\n";
+    if (group == "tag") {
+        ss << "INNER JOIN task_tags ON task_tags.task_id = " << task_col << "\n";
+    }
+    if (done) {
+        ss << "WHERE tasks.complete = 1 AND tasks.time_done "
+           << "BETWEEN ?1 * 86400 AND ?2 * 86400 + 86399\n";
+    } else {
+        ss << "WHERE daily_totals.day BETWEEN ?1 AND ?2\n";
+    }
+    if (!group.empty()) {
+        ss << "AND " << key_col << " IN (";
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ss << (i == 0 ? "" : ", ") << ":id" << i;
+        }
+        ss << ")\n";
+    }
+    // Grouped by position, since the key is the constant 0 without a group
+    ss << "GROUP BY 1, 2";
+
+    sqlite3_stmt *stmt = this->prepare(ss.str());
+    sqlite3_bind_int(stmt, 1, from_day - EPOCH_RDN);
+    sqlite3_bind_int(stmt, 2, until_day - EPOCH_RDN);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        std::string name = ":id" + std::to_string(i);
+        sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt,
+                         name.c_str()), ids[i]);
+    }
+    this->execute_stmt(stmt, fill_grad_data, &series,
+                       "ERROR: Failed to query statistics");
 }
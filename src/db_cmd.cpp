@@ -0,0 +1,32 @@
+//
+// Implementations of the subroutines for maintaining the database
+//
+
+#include <iostream>
+
+#include "db_cmd.hpp"
+#include "database.hpp"
+
+
+/**
+ * Description: gathers statistics about the tables and indexes of the
+ * database, so that queries keep using the right indexes as it grows
+ */
+void tm_db_cmd::handle_analyze() {
+    auto &db = tm_db::shared_db();
+    db.analyze();
+    std::cout << "Database analyzed" << std::endl;
+}
+
+
+/**
+ * Description: recomputes the daily totals of time worked from the
+ * sessions, they are normally kept up to date as sessions change
+ */
+void tm_db_cmd::handle_rebuild() {
+    auto &db = tm_db::shared_db();
+    db.begin_transaction();
+    db.rebuild_rollup();
+    db.commit_transaction();
+    std::cout << "Daily totals rebuilt" << std::endl;
+}
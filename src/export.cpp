@@ -0,0 +1,224 @@
+//
+// Implementations of the subroutines for exporting the database
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "export.hpp"
+#include "import.hpp"
+#include "database.hpp"
+#include "utils.hpp"
+
+// Records are rendered into a buffer which is written out once it reaches
+// this size, so the output is written in a few large chunks
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+// Separates the tags of a task in the rows from TMDatabase::export_records
+#define EXPORT_TAG_SEP '\x1f'
+
+
+struct ExportWriter {
+    FILE *out;
+    bool csv;
+    std::string buffer;
+};
+
+
+/**
+ * Description: writes out everything in the buffer of the writer
+ */
+static void flush_writer(ExportWriter &writer) {
+    fwrite(writer.buffer.data(), 1, writer.buffer.size(), writer.out);
+    writer.buffer.clear();
+}
+
+
+/**
+ * Description: appends str to buf as a JSON string, or null if str is NULL
+ */
+static void append_json_string(std::string &buf, const char *str) {
+    if (str == NULL) {
+        buf += "null";
+        return;
+    }
+    const char *hex = "0123456789abcdef";
+    buf += '"';
+    for (const char *c = str; *c; ++c) {
+        switch (*c) {
+            case '"': buf += "\\\""; break;
+            case '\\': buf += "\\\\"; break;
+            case '\n': buf += "\\n"; break;
+            case '\r': buf += "\\r"; break;
+            case '\t': buf += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(*c) < 0x20) {
+                    buf += "\\u00";
+                    buf += hex[(*c >> 4) & 0xf];
+                    buf += hex[*c & 0xf];
+                } else {
+                    buf += *c;
+                }
+        }
+    }
+    buf += '"';
+}
+
+
+/**
+ * Description: appends str to buf as a CSV field, the field is only quoted
+ * if it contains a comma, quote or newline
+ */
+static void append_csv_field(std::string &buf, const char *str) {
+    if (str == NULL) {
+        return;
+    }
+    if (strpbrk(str, ",\"\r\n") == NULL) {
+        buf += str;
+        return;
+    }
+    buf += '"';
+    for (const char *c = str; *c; ++c) {
+        if (*c == '"') {
+            buf += '"';
+        }
+        buf += *c;
+    }
+    buf += '"';
+}
+
+
+/**
+ * Description: Callback that renders one row from export_records into the
+ * ExportWriter that data points to
+ */
+static int export_callback(void* data, int argc, char** argv, char** cols) {
+    ExportWriter &writer = *(ExportWriter*) data;
+    std::string &buf = writer.buffer;
+    std::string type(argv[0]);
+
+    const std::vector<std::string> *names;
+    if (type == "tag") {
+        names = &tm_import::TAG_FIELDS;
+    } else if (type == "proj") {
+        names = &tm_import::PROJ_FIELDS;
+    } else if (type == "task") {
+        names = &tm_import::TASK_FIELDS;
+    } else {
+        names = &tm_import::SESS_FIELDS;
+    }
+
+    if (writer.csv) {
+        buf += type;
+    } else {
+        buf += "{\"type\":\"" + type + "\"";
+    }
+    for (size_t i = 0; i < names->size(); ++i) {
+        const std::string &name = (*names)[i];
+        const char *value = argv[i + 1];
+        if (writer.csv) {
+            buf += ',';
+        } else {
+            buf += ",\"" + name + "\":";
+        }
+
+        if (name == "tags") {
+            // Tags are separated by ';' in CSV, and are an array in JSON
+            std::string tags(value ? value : "");
+            if (writer.csv) {
+                std::string list;
+                for (char c : tags) {
+                    if (c == EXPORT_TAG_SEP) {
+                        list += ';';
+                        continue;
+                    } else if (c == ';' || c == '\\') {
+                        list += '\\';
+                    }
+                    list += c;
+                }
+                append_csv_field(buf, list.c_str());
+                continue;
+            }
+            buf += '[';
+            size_t start = 0;
+            while (value && start <= tags.size()) {
+                size_t end = tags.find(EXPORT_TAG_SEP, start);
+                if (end == std::string::npos) {
+                    end = tags.size();
+                }
+                if (start != 0) {
+                    buf += ',';
+                }
+                append_json_string(buf, tags.substr(start, end - start).c_str());
+                start = end + 1;
+            }
+            buf += ']';
+        } else if (writer.csv) {
+            append_csv_field(buf, value);
+        } else if ((name == "complete" || name == "length" || name == "id" ||
+                    name == "task_id") && value) {
+            buf += value;
+        } else {
+            append_json_string(buf, value);
+        }
+    }
+    buf += writer.csv ? "\n" : "}\n";
+
+    if (buf.size() >= EXPORT_BUFFER_SIZE) {
+        flush_writer(writer);
+    }
+    return 0;
+}
+
+
+/**
+ * Description: writes every tag, project, task and session to a file or
+ * stdout, the records are streamed so memory use stays bounded regardless
+ * of the size of the database
+ * @param[in] file_name: the file to write, writes to stdout if empty
+ * @param[in] format: either "jsonl" or "csv", if empty the format is
+ * inferred from the extension of file_name
+ */
+void tm_export::handle_export(const std::string &file_name,
+                              std::string format) {
+    if (format.empty()) {
+        format = tm_utils::has_extension(file_name, ".csv") ? "csv" : "jsonl";
+    }
+    if (format != "jsonl" && format != "csv") {
+        std::cerr << "ERROR: '" << format << "' is not a valid format,"
+                  << " use either 'jsonl' or 'csv'" << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    ExportWriter writer;
+    writer.csv = format == "csv";
+    writer.buffer.reserve(EXPORT_BUFFER_SIZE + 4096);
+    if (file_name.empty()) {
+        writer.out = stdout;
+    } else if ((writer.out = fopen(file_name.c_str(), "w")) == NULL) {
+        std::cerr << "ERROR: could not open '" << file_name << "'"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    auto &db = tm_db::shared_db();
+    db.export_records(export_callback, &writer);
+    flush_writer(writer);
+
+    bool failed = ferror(writer.out);
+    if (writer.out != stdout) {
+        failed = fclose(writer.out) != 0 || failed;
+    } else {
+        failed = fflush(stdout) != 0 || failed;
+    }
+    if (failed) {
+        std::cerr << "ERROR: failed to write the exported records" << std::endl;
+        throw tm_utils::CommandError();
+    }
+}
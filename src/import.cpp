@@ -0,0 +1,548 @@
+//
+// Implementations of the subroutines for importing records in bulk
+//
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+
+#include "import.hpp"
+#include "batch.hpp"
+#include "database.hpp"
+#include "utils.hpp"
+
+
+// One record from the stream, null values are left out of fields
+struct Record {
+    std::unordered_map<std::string, std::string> fields;
+    std::vector<std::string> tags;
+};
+
+
+/**
+ * Description: prints an error about a record and exits, since the import
+ * is one transaction that never got committed, nothing is imported
+ */
+static void import_error(int line_num, const std::string &message) {
+    std::cerr << "ERROR: line " << line_num << ": " << message << std::endl;
+    std::cerr << "Nothing was imported." << std::endl;
+    throw tm_utils::CommandError();
+}
+
+
+/**
+ * Description: appends a unicode code point to out as UTF-8
+ */
+static void append_utf8(unsigned int cp, std::string &out) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xc0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xe0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+
+/**
+ * Description: skips whitespace in line starting at pos
+ */
+static inline void skip_ws(const std::string &line, size_t &pos) {
+    while (pos < line.size() && isspace(line[pos])) {
+        ++pos;
+    }
+}
+
+
+/**
+ * Description: parses the JSON string that starts at line[pos]
+ * @param[out] out: the unescaped string
+ * @return Returns false if the string is malformed
+ */
+static bool parse_json_string(const std::string &line, size_t &pos,
+                              std::string &out) {
+    if (pos >= line.size() || line[pos] != '"') {
+        return false;
+    }
+    ++pos;
+    out.clear();
+    while (pos < line.size() && line[pos] != '"') {
+        char c = line[pos++];
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (pos >= line.size()) {
+            return false;
+        }
+        c = line[pos++];
+        switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                if (pos + 4 > line.size()) {
+                    return false;
+                }
+                unsigned int cp = strtoul(line.substr(pos, 4).c_str(), NULL, 16);
+                pos += 4;
+                // Combine surrogate pairs into a single code point
+                if (cp >= 0xd800 && cp < 0xdc00 && pos + 6 <= line.size()
+                        && line[pos] == '\\' && line[pos + 1] == 'u') {
+                    unsigned int low = strtoul(line.substr(pos + 2, 4).c_str(),
+                                               NULL, 16);
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    pos += 6;
+                }
+                append_utf8(cp, out);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    if (pos >= line.size()) {
+        return false;
+    }
+    ++pos;
+    return true;
+}
+
+
+/**
+ * Description: parses a line holding a flat JSON object, whose values are
+ * strings, numbers, booleans, null, or (for tags) an array of strings
+ * @return Returns false if the line isn't a valid record
+ */
+static bool parse_json_record(const std::string &line, Record &record) {
+    size_t pos = 0;
+    skip_ws(line, pos);
+    if (pos >= line.size() || line[pos++] != '{') {
+        return false;
+    }
+    skip_ws(line, pos);
+    if (pos < line.size() && line[pos] == '}') {
+        return true;
+    }
+    std::string key, value;
+    while (true) {
+        skip_ws(line, pos);
+        if (!parse_json_string(line, pos, key)) {
+            return false;
+        }
+        skip_ws(line, pos);
+        if (pos >= line.size() || line[pos++] != ':') {
+            return false;
+        }
+        skip_ws(line, pos);
+        if (pos >= line.size()) {
+            return false;
+        }
+        if (line[pos] == '"') {
+            if (!parse_json_string(line, pos, value)) {
+                return false;
+            }
+            record.fields[key] = value;
+        } else if (line[pos] == '[') {
+            if (key != "tags") {
+                return false;
+            }
+            ++pos;
+            skip_ws(line, pos);
+            while (pos < line.size() && line[pos] != ']') {
+                if (!parse_json_string(line, pos, value)) {
+                    return false;
+                }
+                record.tags.push_back(value);
+                skip_ws(line, pos);
+                if (pos < line.size() && line[pos] == ',') {
+                    ++pos;
+                    skip_ws(line, pos);
+                }
+            }
+            if (pos >= line.size()) {
+                return false;
+            }
+            ++pos;
+        } else {
+            // Numbers, booleans and null are read up to the next delimiter
+            size_t end = line.find_first_of(",} \t", pos);
+            if (end == std::string::npos) {
+                return false;
+            }
+            value = line.substr(pos, end - pos);
+            pos = end;
+            if (value == "true") {
+                record.fields[key] = "1";
+            } else if (value == "false") {
+                record.fields[key] = "0";
+            } else if (value != "null") {
+                record.fields[key] = value;
+            }
+        }
+        skip_ws(line, pos);
+        if (pos >= line.size()) {
+            return false;
+        }
+        char c = line[pos++];
+        if (c == '}') {
+            return true;
+        } else if (c != ',') {
+            return false;
+        }
+    }
+}
+
+
+/**
+ * Description: splits a CSV line into its fields, fields can be quoted with
+ * '"', in which case '""' is an escaped quote
+ * @return Returns false if a quoted field isn't closed
+ */
+static bool split_csv(const std::string &line, std::vector<std::string> &fields) {
+    fields.clear();
+    std::string field;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                field += '"';
+                ++i;
+            } else if (c == '"') {
+                quoted = false;
+            } else {
+                field += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.push_back(field);
+            field.clear();
+        } else if (c != '\r') {
+            field += c;
+        }
+    }
+    fields.push_back(field);
+    return !quoted;
+}
+
+
+/**
+ * Description: parses a CSV line into a record, the first field is the type
+ * of the record, and the rest are in the order defined in import.hpp
+ * @return Returns false if the line isn't a valid record
+ */
+static bool parse_csv_record(const std::string &line, Record &record) {
+    std::vector<std::string> values;
+    if (!split_csv(line, values)) {
+        return false;
+    }
+    const std::string &type = values[0];
+    const std::vector<std::string> *names;
+    if (type == "tag") {
+        names = &tm_import::TAG_FIELDS;
+    } else if (type == "proj") {
+        names = &tm_import::PROJ_FIELDS;
+    } else if (type == "task") {
+        names = &tm_import::TASK_FIELDS;
+    } else if (type == "sess") {
+        names = &tm_import::SESS_FIELDS;
+    } else {
+        return false;
+    }
+    record.fields["type"] = type;
+    for (size_t i = 1; i < values.size() && i <= names->size(); ++i) {
+        const std::string &name = (*names)[i - 1];
+        if (name == "tags") {
+            // Tags are separated by ';', and '\' escapes the next character
+            const std::string &list = values[i];
+            std::string tag;
+            for (size_t j = 0; j <= list.size(); ++j) {
+                if (j == list.size() || list[j] == ';') {
+                    if (!tag.empty()) {
+                        record.tags.push_back(tag);
+                    }
+                    tag.clear();
+                } else if (list[j] == '\\' && j + 1 < list.size()) {
+                    tag += list[++j];
+                } else {
+                    tag += list[j];
+                }
+            }
+        } else if (!values[i].empty()) {
+            record.fields[name] = values[i];
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Description: converts a date into the format stored in the database
+ * @param[in] date: YYYY-MM-DD, YYYY-MM-DD HH:MM or YYYY-MM-DD HH:MM:SS.SSS
+ * @param[out] out: the date as YYYY-MM-DD HH:MM:SS.SSS
+ * @return Returns false if the date isn't valid
+ */
+static bool normalize_datetime(const std::string &date, std::string &out) {
+    if (date.size() < 10 || !tm_utils::valid_date(date.substr(0, 10))) {
+        return false;
+    }
+    if (date.size() == 10) {
+        out = date + " 00:00:00.000";
+    } else if (date.size() == 16 && tm_utils::valid_time(date.substr(11, 5))) {
+        out = date + ":00.000";
+    } else if (date.size() == 23 && tm_utils::valid_time(date.substr(11, 5))) {
+        out = date;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Description: returns the value of a field, or an empty string if the
+ * record doesn't have that field
+ */
+static std::string field(const Record &record, const std::string &name) {
+    auto it = record.fields.find(name);
+    return it == record.fields.end() ? "" : it->second;
+}
+
+
+/**
+ * Description: parses a field holding an integer
+ * @return Returns false if the field is set, but isn't an integer
+ */
+static bool int_field(const Record &record, const std::string &name,
+                      int &out) {
+    std::string value = field(record, name);
+    if (value.empty()) {
+        return true;
+    }
+    char *end;
+    long num = strtol(value.c_str(), &end, 10);
+    if (*end != '\0') {
+        return false;
+    }
+    out = static_cast<int>(num);
+    return true;
+}
+
+
+// The number of records imported of each type
+struct ImportCounts {
+    int tags = 0;
+    int projects = 0;
+    int tasks = 0;
+    int sessions = 0;
+};
+
+
+/**
+ * Description: validates a record and inserts it into the database
+ */
+static void import_record(tm_db::TMDatabase &db, tm_db::IdMaps &ids,
+                          const Record &record, int line_num,
+                          ImportCounts &counts) {
+    std::string type = field(record, "type");
+    std::string name = field(record, "name");
+    if (type == "tag") {
+        tm_db::Tag tag = {name, field(record, "color")};
+        if (tag.color.empty()) {
+            tag.color = "none";
+        }
+        if (name.empty()) {
+            import_error(line_num, "tag is missing a name");
+        }
+        if (tm_color::VALID_COLORS.find(tag.color)
+                == tm_color::VALID_COLORS.end()) {
+            import_error(line_num, "'" + tag.color + "' is not a valid color");
+        }
+        db.import_tag(tag, ids);
+        ++counts.tags;
+    } else if (type == "proj") {
+        int complete = 0;
+        if (name.empty()) {
+            import_error(line_num, "project is missing a name");
+        }
+        if (!int_field(record, "complete", complete)) {
+            import_error(line_num, "complete must be 0 or 1");
+        }
+        db.import_project(name, complete ? 1 : 0, ids);
+        ++counts.projects;
+    } else if (type == "task") {
+        tm_db::Task task;
+        task.name = name;
+        task.proj_name = field(record, "project");
+        task.tags = record.tags;
+        if (name.empty()) {
+            import_error(line_num, "task is missing a name");
+        }
+        if (!normalize_datetime(field(record, "due"), task.due)) {
+            import_error(line_num, "'" + field(record, "due")
+                         + "' is not a valid due date");
+        }
+        if (!int_field(record, "complete", task.complete)) {
+            import_error(line_num, "complete must be 0 or 1");
+        }
+        task.complete = task.complete ? 1 : 0;
+        std::string time_done = field(record, "time_done");
+        if (!time_done.empty()
+                && !normalize_datetime(time_done, task.time_done)) {
+            import_error(line_num, "'" + time_done
+                         + "' is not a valid completion date");
+        }
+        if (!task.proj_name.empty()
+                && ids.projects.find(task.proj_name) == ids.projects.end()) {
+            import_error(line_num, "'" + task.proj_name
+                         + "' is not a valid project");
+        }
+        for (auto const &tag : task.tags) {
+            if (ids.tags.find(tag) == ids.tags.end()) {
+                import_error(line_num, "'" + tag + "' is not a valid tag");
+            }
+        }
+        int key = 0;
+        if (!int_field(record, "id", key)) {
+            import_error(line_num, "id must be an integer");
+        }
+        if (key != 0 && ids.task_keys.find(key) != ids.task_keys.end()) {
+            import_error(line_num, "task id " + std::to_string(key)
+                         + " appears more than once");
+        }
+        db.import_task(task, key, ids);
+        ++counts.tasks;
+    } else if (type == "sess") {
+        tm_db::Sess sess;
+        sess.task_name = field(record, "task");
+        sess.desc = field(record, "desc");
+        sess.length = 0;
+        if (!int_field(record, "task_id", sess.task_key)) {
+            import_error(line_num, "task_id must be an integer");
+        }
+        // Sessions of tasks that were removed don't reference any task
+        if (sess.task_key != 0) {
+            if (ids.task_keys.find(sess.task_key) == ids.task_keys.end()) {
+                import_error(line_num, "task id "
+                             + std::to_string(sess.task_key)
+                             + " is not the id of an earlier task record");
+            }
+        } else if (!sess.task_name.empty()
+                && ids.tasks.find(sess.task_name) == ids.tasks.end()) {
+            import_error(line_num, "'" + sess.task_name
+                         + "' is not a valid task");
+        }
+        if (!normalize_datetime(field(record, "time_started"),
+                                sess.time_started)) {
+            import_error(line_num, "'" + field(record, "time_started")
+                         + "' is not a valid start date");
+        }
+        if (!int_field(record, "length", sess.length) || sess.length <= 0) {
+            import_error(line_num, "length must be a positive number of seconds");
+        }
+        db.import_sess(sess, ids);
+        ++counts.sessions;
+    } else {
+        import_error(line_num, "'" + type + "' is not a valid record type");
+    }
+}
+
+
+/**
+ * Description: imports all the records from a file or stdin inside a
+ * single transaction, if any record is invalid nothing is imported
+ * @param[in] file_name: the file to read, reads stdin if empty
+ * @param[in] format: either "jsonl" or "csv", if empty the format is
+ * inferred from the extension of file_name
+ */
+void tm_import::handle_import(const std::string &file_name,
+                              std::string format) {
+    if (format.empty()) {
+        format = tm_utils::has_extension(file_name, ".csv") ? "csv" : "jsonl";
+    }
+    if (format != "jsonl" && format != "csv") {
+        std::cerr << "ERROR: '" << format << "' is not a valid format,"
+                  << " use either 'jsonl' or 'csv'" << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    // The stdin of a batch holds its commands, and the stdin of tm serve
+    // isn't the client's
+    if (file_name.empty() &&
+            (tm_batch::running() || tm_utils::client_term.active)) {
+        std::cerr << "ERROR: tm import can't read stdin inside of tm batch,"
+                  << " use --file" << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    std::ifstream file;
+    if (!file_name.empty()) {
+        file.open(file_name);
+        if (!file.is_open()) {
+            std::cerr << "ERROR: could not open '" << file_name << "'"
+                      << std::endl;
+            throw tm_utils::CommandError();
+        }
+    }
+    std::istream &in = file_name.empty() ? std::cin : file;
+
+    auto &db = tm_db::shared_db();
+    db.begin_transaction();
+    tm_db::IdMaps ids = db.load_id_maps();
+
+    ImportCounts counts;
+    std::string line;
+    int line_num = 0;
+    while (std::getline(in, line)) {
+        ++line_num;
+        size_t start = line.find_first_not_of(" \t\r");
+        // Skip blank lines and comments
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        // A quoted CSV field can span several lines, keep reading until
+        // all of the quotes in the record are closed
+        int record_line = line_num;
+        std::string next;
+        while (format == "csv"
+                && std::count(line.begin(), line.end(), '"') % 2 == 1
+                && std::getline(in, next)) {
+            ++line_num;
+            line += "\n" + next;
+        }
+        Record record;
+        bool valid = format == "csv" ? parse_csv_record(line, record)
+                                     : parse_json_record(line, record);
+        if (!valid) {
+            import_error(record_line, "could not parse record");
+        }
+        import_record(db, ids, record, record_line, counts);
+    }
+    db.commit_transaction();
+
+    std::cout << "Imported " << counts.tags << " tags, "
+              << counts.projects << " projects, "
+              << counts.tasks << " tasks and "
+              << counts.sessions << " sessions." << std::endl;
+}
@@ -20,7 +20,7 @@
  * @return Returns
  */
 void tm_proj::handle_rm(std::string proj_name, bool hard) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.remove_project(proj_name, hard);
 }
 
@@ -32,7 +32,7 @@ void tm_proj::handle_rm(std::string proj_name, bool hard) {
  * @param[in] reversed: If true, the project will be set to incomplete status
  */
 void tm_proj::handle_done(std::string proj_name, bool reversed) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.complete_project(proj_name, reversed ? 0 : 1);
 }
 
@@ -42,11 +42,11 @@ void tm_proj::handle_done(std::string proj_name, bool reversed) {
  * @param[in] proj_name: the name of the project to be added
  */
 void tm_proj::handle_add(const std::string &proj_name) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     if (proj_name.length() > MAX_PROJ_LENGTH) {
         std::cerr << "ERROR: '" << proj_name << "' is too long." << std::endl;
         std::cerr << "Please keep project names under 64 chars." << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     db.add_project(proj_name);
 }
@@ -63,6 +63,6 @@ void tm_proj::handle_add(const std::string &proj_name) {
  */
 void tm_proj::handle_list(bool show_tasks, bool display_done,
                           const std::vector<std::string> &proj_names) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.list_projects(show_tasks, display_done, proj_names);
 }
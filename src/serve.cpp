@@ -0,0 +1,318 @@
+//
+// Implementations of the tm daemon and of the client that forwards commands
+// to it
+//
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+
+#include "serve.hpp"
+#include "batch.hpp"
+#include "database.hpp"
+#include "utils.hpp"
+
+// Limits on the requests of a client, so that a malformed request can't make
+// the daemon allocate an unbounded amount of memory
+#define MAX_ARGS 4096
+#define MAX_ARG_LEN (1 << 20)
+
+// How long the daemon waits on a client before dropping it, in seconds
+#define CLIENT_TIMEOUT 2
+
+
+// Set by SIGINT and SIGTERM to stop the daemon once its current request is
+// done
+static volatile sig_atomic_t stop_serving = 0;
+
+static void handle_stop(int) {
+    stop_serving = 1;
+}
+
+
+// Appends an integer to a message in native byte order
+template <typename T>
+static void append_int(std::string &buf, T val) {
+    buf.append((const char*) &val, sizeof(val));
+}
+
+
+// Appends a string to a message, prefixed by its length
+static void append_str(std::string &buf, const std::string &str) {
+    append_int(buf, (uint32_t) str.size());
+    buf += str;
+}
+
+
+template <typename T>
+static bool read_int(int fd, T &val) {
+    return tm_utils::read_all(fd, (char*) &val, sizeof(val));
+}
+
+
+// Reads a string prefixed by its length, that is at most max_len long
+static bool read_str(int fd, std::string &str, uint32_t max_len) {
+    uint32_t len;
+    if (!read_int(fd, len) || len > max_len) {
+        return false;
+    }
+    str.resize(len);
+    return tm_utils::read_all(fd, &str[0], len);
+}
+
+
+/**
+ * Description: fills in the address of the socket of the daemon
+ * @param[out] addr: the address of the socket
+ * @return false if the path of the socket is too long for an address
+ */
+static bool socket_addr(struct sockaddr_un &addr) {
+    std::string path = tm_utils::home_dir() + TM_DIR + SOCKET_FILE;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+
+/**
+ * Description: connects to the socket of the daemon
+ * @return the connected socket, or -1 if the daemon isn't running
+ */
+static int connect_daemon() {
+    struct sockaddr_un addr;
+    if (!socket_addr(addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * Description: reads one command from a client, runs it with stdout and
+ * stderr captured, and sends back its status and output
+ * @param[in] db: the database shared by every command
+ * @param[in] fd: the socket of the client
+ */
+static void serve_client(tm_db::TMDatabase &db, int fd) {
+    struct timeval timeout = {CLIENT_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    uint32_t cols, argc;
+    uint8_t is_tty;
+    std::string path;
+    if (!read_int(fd, cols) || !read_int(fd, is_tty) ||
+            !read_str(fd, path, MAX_ARG_LEN) || !read_int(fd, argc) ||
+            argc == 0 || argc > MAX_ARGS) {
+        return;
+    }
+    std::vector<std::string> args(argc);
+    for (auto &arg : args) {
+        if (!read_str(fd, arg, MAX_ARG_LEN)) {
+            return;
+        }
+    }
+    if (path != db.path()) {
+        tm_utils::write_all(fd, "\0", 1);
+        return;
+    }
+
+    std::ostringstream out, err;
+    auto *cout_buf = std::cout.rdbuf(out.rdbuf());
+    auto *cerr_buf = std::cerr.rdbuf(err.rdbuf());
+    tm_utils::client_term.active = true;
+    tm_utils::client_term.cols = cols;
+    tm_utils::client_term.is_tty = is_tty;
+    tm_utils::client_term.paged = false;
+
+    int32_t status = tm_batch::run_command(db, args);
+
+    tm_utils::client_term.active = false;
+    std::cout.rdbuf(cout_buf);
+    std::cerr.rdbuf(cerr_buf);
+
+    std::string response;
+    append_int(response, (uint8_t) 1);
+    append_int(response, status);
+    append_int(response, (uint8_t) tm_utils::client_term.paged);
+    append_str(response, out.str());
+    append_str(response, err.str());
+    tm_utils::write_all(fd, response.data(), response.size());
+}
+
+
+/**
+ * Description: runs the daemon in the foreground until it is interrupted or
+ * terminated, the commands of the clients are run one at a time, each inside
+ * of its own transaction
+ */
+void tm_serve::handle_serve() {
+    // Opening the database first also creates the directory of the socket
+    auto &db = tm_db::shared_db();
+
+    struct sockaddr_un addr;
+    if (!socket_addr(addr)) {
+        std::cerr << "ERROR: the path of the socket is too long" << std::endl;
+        throw tm_utils::CommandError();
+    }
+    int fd = connect_daemon();
+    if (fd >= 0) {
+        close(fd);
+        std::cerr << "ERROR: tm serve is already running" << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    // A socket left behind by a daemon that crashed is replaced, and only
+    // the owner of the socket can connect to it
+    unlink(addr.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t prev_mask = umask(077);
+    bool bound = fd >= 0 &&
+        bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+    umask(prev_mask);
+    if (!bound || listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "ERROR: failed to listen on '" << addr.sun_path << "': "
+                  << strerror(errno) << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    // Without SA_RESTART, so that a signal interrupts accept
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    // A client that leaves early must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "tm serve: listening on " << addr.sun_path << " for '"
+              << db.path() << "'" << std::endl;
+    while (!stop_serving) {
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "ERROR: failed to accept a client: "
+                      << strerror(errno) << std::endl;
+            break;
+        }
+        serve_client(db, client);
+        close(client);
+    }
+    close(fd);
+    unlink(addr.sun_path);
+    std::cout << "tm serve: stopped" << std::endl;
+}
+
+
+/**
+ * Description: sends a command to the daemon and writes its output, if the
+ * daemon is running and the command can be run by it. Commands that read or
+ * write files, stdin or the terminal are always run locally, and so are
+ * commands sent to a running session, which needs the write lock to reply
+ * @param[in] argc: the number of arguments, including the program name
+ * @param[in] argv: the arguments, in the same form as main receives them
+ * @param[out] status: the exit status of the command, if it was sent
+ * @return true if the command was run by the daemon
+ */
+bool tm_serve::forward(int argc, char **argv, int &status) {
+    // The --db flag comes before the command, and is needed to check that
+    // the daemon has the same database open
+    int cmd = 1;
+    std::string arg = argc > 1 ? argv[1] : "";
+    if (arg == "--db" && argc > 2) {
+        tm_db::set_db_path(argv[2]);
+        cmd = 3;
+    } else if (arg.compare(0, 5, "--db=") == 0) {
+        tm_db::set_db_path(arg.substr(5));
+        cmd = 2;
+    }
+    if (argc <= cmd) {
+        return false;
+    }
+    // Every process gets its own in-memory database, which would otherwise
+    // be the daemon's, kept from one command to the next
+    if (tm_db::db_path() == ":memory:") {
+        return false;
+    }
+    std::string command = argv[cmd];
+    std::string sub = argc > cmd + 1 ? argv[cmd + 1] : "";
+    if (command == "serve" || command == "batch" || command == "import" ||
+            command == "export") {
+        return false;
+    }
+    if (command == "sess" && (sub == "start" || sub == "stop" ||
+                              sub == "pause" || sub == "resume" ||
+                              sub == "extend")) {
+        return false;
+    }
+
+    int fd = connect_daemon();
+    if (fd < 0) {
+        return false;
+    }
+    std::string request;
+    append_int(request, (uint32_t) tm_utils::num_cols());
+    append_int(request, (uint8_t) isatty(STDOUT_FILENO));
+    append_str(request, tm_db::db_path());
+    append_int(request, (uint32_t) argc);
+    for (int i = 0; i < argc; ++i) {
+        append_str(request, argv[i]);
+    }
+    // Nothing was run if the request couldn't be sent, so it runs locally
+    if (!tm_utils::write_all(fd, request.data(), request.size())) {
+        close(fd);
+        return false;
+    }
+
+    uint8_t accepted;
+    int32_t response_status;
+    uint8_t paged;
+    std::string out, err;
+    bool ok = read_int(fd, accepted);
+    if (ok && !accepted) {
+        close(fd);
+        return false;
+    }
+    ok = ok && read_int(fd, response_status) && read_int(fd, paged) &&
+        read_str(fd, out, UINT32_MAX) && read_str(fd, err, UINT32_MAX);
+    close(fd);
+    if (!ok) {
+        std::cerr << "ERROR: lost the connection to tm serve" << std::endl;
+        status = 1;
+        return true;
+    }
+
+    if (paged) {
+        tm_utils::page_output(out);
+    } else {
+        std::cout.write(out.data(), out.size());
+        std::cout.flush();
+    }
+    std::cerr.write(err.data(), err.size());
+    status = response_status;
+    return true;
+}
@@ -2,16 +2,26 @@
 // Implementations of the different subroutines for handling sess commands
 //
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
 
 #include <string>
 #include <vector>
 #include <iostream>
-#include <chrono>
-#include <thread>
 #include <iomanip>
+#include <sstream>
+#include <cmath>
 
 #include "sess.hpp"
+#include "batch.hpp"
 #include "database.hpp"
 #include "utils.hpp"
 
@@ -29,87 +39,491 @@
 #define MIN_BAR_LENGTH 10
 #define TEXT_LEN 40
 
-// The length of the progress bar
-#define BAR_WIDTH (MAX(tm_utils::num_cols() - TEXT_LEN, \
-            MIN_BAR_LENGTH))
+// The cells of the progress bar that are done, and the one in progress
+#define DONE_CELL 0x25A6 // ▦
+#define HEAD_CELL 0x25B6 // ▶
+
+// Seconds between the frames of the progress bar when stdout isn't a
+// terminal, where every frame is a new line rather than a redraw
+#define NO_TTY_REFRESH 60
 
 // Maximum session length is 3 hours
 #define MAX_SESS_LENGTH 180
 
 
-// Global variables relating to the session, allows for access within
-// functions
-static int len = 0;
-static int sess_task_id;
-static std::string sess_desc;
-static std::string start;
+// The longest request or reply sent over the control socket of a session
+#define MAX_CONTROL_MSG 256
+
+// How long either end of a control socket waits on the other, in seconds
+#define CONTROL_TIMEOUT 1
+
+// Returned by wait_until when a command arrives on the control socket
+#define CONTROL_EVENT -1
+
+
+// The pipe that signals are written into by handle_signal, so that they are
+// handled by the session loop instead of inside of the signal handler
+static int signal_pipe[2] = {-1, -1};
+
+
+// The state of a session running in the foreground, which the commands sent
+// to its control socket change
+struct RunningSess {
+    int id;
+    // the planned length, and the length at which it ends, in seconds
+    int length;
+    int limit;
+    // the instant it started on monotonic_now, moved forward by the time
+    // spent paused, and the instant it was paused, negative if it isn't
+    double start_time;
+    double paused_at = -1;
+    // the time worked so far, and the time last saved to the database
+    int elapsed = 0;
+    int saved = 0;
+    // set by tm sess stop, whose client is answered once the session closes
+    bool stopped = false;
+    int stop_fd = -1;
+};
 
-static bool nointerrupt;
 
 /**
- * Description: Generates a progress bar
+ * Description: Draws a progress bar, followed by the time left
+ * @param[in] line: the line of the terminal to draw the bar on
  * @param[in] progress: a double between 0 and 1.0, indicating
  * a percentage of progress
- * @param[in] bar_width: the number of characters on the screen for
- * the bar to take up
+ * @param[in] seconds_left: the time left in the session
  */
-void print_bar(double progress, int bar_width) {
-    if (bar_width < MIN_BAR_LENGTH) {
-        return;
-    }
-    std::cout << "[";
+static void draw_bar(tm_utils::LineRenderer &line, double progress,
+                     int seconds_left) {
+    int bar_width = MAX(line.width() - TEXT_LEN, MIN_BAR_LENGTH);
     int pos = bar_width * progress;
+    line.begin();
+    line.put('[');
     for (int i = 0; i < bar_width; ++i) {
-        if (i < pos || (i == pos && progress >= 1.0)) std::cout << "▦";
-        else if (i == pos) std::cout << "▶";
-        else std::cout << " ";
+        if (i < pos || (i == pos && progress >= 1.0)) line.put(DONE_CELL);
+        else if (i == pos) line.put(HEAD_CELL);
+        else line.put(' ');
+    }
+    char text[64];
+    snprintf(text, sizeof(text), "]  %2d%% Time Left: %s (H:MM:SS)",
+             int(progress * 100.0),
+             tm_utils::sec_to_time(seconds_left).c_str());
+    line.put(text);
+    line.end();
+}
+
+
+/**
+ * Description: Draws the amount of overtime worked
+ * @param[in] line: the line of the terminal to draw on
+ * @param[in] seconds: the seconds worked past the length of the session
+ */
+static void draw_overtime(tm_utils::LineRenderer &line, int seconds) {
+    line.begin();
+    line.put("Overtime amount: ");
+    line.put(tm_utils::sec_to_time(seconds).c_str());
+    line.end();
+}
+
+
+/**
+ * Description: handle ^C exception, the signal is passed on to the session
+ * loop, since nothing else is safe to do inside of a signal handler
+ */
+static void handle_signal(int sig) {
+    int saved_errno = errno;
+    unsigned char byte = sig;
+    if (write(signal_pipe[1], &byte, 1) < 0) {
+        // The pipe is only full if the loop already has signals to handle
+    }
+    errno = saved_errno;
+}
+
+
+/**
+ * Description: returns the seconds on a clock that never goes backwards,
+ * unlike the time of day, and keeps counting while the machine is suspended
+ * where the system supports it
+ */
+static double monotonic_now() {
+    struct timespec ts;
+#ifdef CLOCK_BOOTTIME
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Description: waits until a deadline of monotonic_now, until a signal is
+ * caught, or until a client connects to the control socket, whichever comes
+ * first
+ * @param[in] deadline: the time to wait until, in seconds of monotonic_now,
+ * if negative there is no deadline
+ * @param[in] control_fd: the control socket, ignored if -1
+ * @return the signal that was caught, CONTROL_EVENT if a client connected,
+ * or 0 if the deadline passed
+ */
+static int wait_until(double deadline, int control_fd) {
+    struct pollfd fds[2] = {
+        {signal_pipe[0], POLLIN, 0},
+        {control_fd, POLLIN, 0}
+    };
+    // Rounded up, so that the wait never ends right before the deadline
+    int timeout = -1;
+    if (deadline >= 0) {
+        double remaining = deadline - monotonic_now();
+        timeout = remaining > 0 ? (int) ceil(remaining * 1000) : 0;
+    }
+    if (poll(fds, 2, timeout) <= 0) {
+        return 0;
+    }
+    unsigned char sig;
+    if ((fds[0].revents & POLLIN) && read(signal_pipe[0], &sig, 1) == 1) {
+        return sig;
+    }
+    return (fds[1].revents & POLLIN) ? CONTROL_EVENT : 0;
+}
+
+
+/**
+ * Description: fills in the address of the control socket of a session
+ * @param[in] path: the path of the socket, see TMDatabase::sess_socket
+ * @param[out] addr: the address of the socket
+ * @return false if there is no path, or it is too long for an address
+ */
+static bool control_addr(const std::string &path, struct sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+
+// Makes reads and writes on a socket fail, rather than block, once the other
+// end has been silent for CONTROL_TIMEOUT
+static void set_control_timeout(int fd) {
+    struct timeval timeout = {CONTROL_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+
+/**
+ * Description: reads a message until the other end stops writing, up to
+ * MAX_CONTROL_MSG bytes
+ * @return false if the read failed or timed out
+ */
+static bool read_msg(int fd, std::string &msg) {
+    char buf[MAX_CONTROL_MSG];
+    size_t len = 0;
+    while (len < sizeof(buf)) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    msg.assign(buf, len);
+    return true;
+}
+
+
+/**
+ * Description: listens on the control socket of a session, the session
+ * still runs without one if it can't be created
+ * @param[in] path: the path of the socket, see TMDatabase::sess_socket
+ * @return the listening socket, or -1
+ */
+static int listen_control(const std::string &path) {
+    struct sockaddr_un addr;
+    if (!control_addr(path, addr)) {
+        return -1;
+    }
+    // Only the owner of the socket can connect to it
+    unlink(addr.sun_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    mode_t prev_mask = umask(077);
+    bool bound = fd >= 0 &&
+        bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+    umask(prev_mask);
+    if (!bound || listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "WARNING: failed to listen on '" << path << "': "
+                  << strerror(errno) << ", the session can only be stopped"
+                  << " with ^C" << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * Description: sends a command to the control socket of a session
+ * @param[in] db: the database the session belongs to
+ * @param[in] sess_id: the id of the session
+ * @param[in] request: the command, followed by its arguments
+ * @param[out] reply: the reply of the session, or why there was none
+ * @return true if the session replied "ok", reply is what follows it
+ */
+static bool request_control(tm_db::TMDatabase &db, int sess_id,
+                            const std::string &request, std::string &reply) {
+    // A batch holds the write lock until it ends, and the session needs it
+    // to act on the request, so the request could only time out
+    if (tm_batch::running()) {
+        reply = "session " + std::to_string(sess_id) + " can't be reached"
+            " from inside of tm batch";
+        return false;
+    }
+    struct sockaddr_un addr;
+    int fd = -1;
+    if (control_addr(db.sess_socket(sess_id), addr)) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        reply = "session " + std::to_string(sess_id) + " can't be reached,"
+            " it can only be stopped with ^C";
+        return false;
+    }
+    set_control_timeout(fd);
+
+    bool ok = tm_utils::write_all(fd, request.data(), request.size()) &&
+        shutdown(fd, SHUT_WR) == 0 && read_msg(fd, reply);
+    close(fd);
+    if (!ok || reply.empty()) {
+        reply = "session " + std::to_string(sess_id) + " did not respond";
+        return false;
+    }
+    ok = reply.compare(0, 3, "ok ") == 0;
+    reply = reply.substr(reply.find(' ') + 1);
+    return ok;
+}
+
+
+/**
+ * Description: sends a command to the control socket of a session, raises
+ * an error if it fails
+ * @param[in] db: the database the session belongs to
+ * @param[in] sess_id: the id of the session
+ * @param[in] request: the command, followed by its arguments
+ * @return the reply, without its leading "ok "
+ */
+static std::string send_control(tm_db::TMDatabase &db, int sess_id,
+                                const std::string &request) {
+    std::string reply;
+    if (!request_control(db, sess_id, request, reply)) {
+        std::cerr << "ERROR: " << reply << std::endl;
+        throw tm_utils::CommandError();
+    }
+    return reply;
+}
+
+
+/**
+ * Description: finds the session that a command applies to
+ * @param[in] db: the database the session belongs to
+ * @param[in] sess_id: the id of the session, or 0 for the latest one
+ * @param[in] foreground: if true, detached sessions are ignored
+ * @return the session, raises an error if there is none
+ */
+static tm_db::OpenSess find_session(tm_db::TMDatabase &db, int sess_id,
+                                    bool foreground) {
+    auto sessions = db.open_sessions();
+    for (auto it = sessions.rbegin(); it != sessions.rend(); ++it) {
+        if ((sess_id == 0 || it->id == sess_id) &&
+                (!foreground || it->pid != 0)) {
+            return *it;
+        }
+    }
+    if (sess_id != 0) {
+        std::cerr << "ERROR: session " << sess_id << " is not running";
+    } else {
+        std::cerr << "ERROR: no session is running";
+    }
+    std::cerr << (foreground ? " in the foreground" : "") << std::endl;
+    throw tm_utils::CommandError();
+}
+
+
+// The length a session ends at, once it is extended to length, keeping its
+// overtime if it had any
+static int extended_limit(int length, int limit, int new_length) {
+    return limit > length ? new_length * 3 / 2 : new_length;
+}
+
+
+/**
+ * Description: checks the new length of a session that is being extended
+ * @param[in] length: the planned length of the session, in seconds
+ * @param[in] minutes: the minutes to add to the session
+ * @param[out] err: the reason the session can't be extended
+ * @return the new length, or 0 if the session can't be extended
+ */
+static int extended_length(int length, int minutes, std::string &err) {
+    int new_length = length + minutes * 60;
+    if (minutes <= 0) {
+        err = "the session can only be extended by a positive number of"
+            " minutes";
+        return 0;
+    } else if (new_length > MAX_SESS_LENGTH * 60) {
+        err = "a session can last at most " +
+            std::to_string(MAX_SESS_LENGTH) + " minutes";
+        return 0;
     }
-    std::cout << "]  " << std::setw(2) << std::setfill(' ') 
-        << int(progress * 100.0) << "% ";
+    return new_length;
 }
 
 
 /**
- * Description: handle ^C exception
+ * Description: runs one command sent to the control socket of a running
+ * session, on the session loop, and replies with "ok <message>" or
+ * "error <message>"
+ * @param[in] db: the database the session belongs to
+ * @param[in] line: the line of the terminal the session is drawn on
+ * @param[in] sess: the session, changed by the command
+ * @param[in] control_fd: the listening control socket
  */
-void handle_signal(int sig) {
-    if (!nointerrupt) {
-        // This newline makes sure that the progress bar prints correctly
-        std::cout << std::endl;
-
-        // Exclude sessions less than 60 seconds from the database
-        if (len > 60) {
-            auto db = tm_db::TMDatabase();
-            db.add_sess(start, len, sess_task_id, sess_desc);
+static void handle_control(tm_db::TMDatabase &db, tm_utils::LineRenderer &line,
+                           RunningSess &sess, int control_fd) {
+    int fd = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    set_control_timeout(fd);
+    std::string request;
+    if (!read_msg(fd, request)) {
+        close(fd);
+        return;
+    }
+
+    std::istringstream args(request);
+    std::string command, err;
+    args >> command;
+    std::stringstream reply;
+    bool paused = sess.paused_at >= 0;
+    if (command == "status") {
+        reply << sess.elapsed << " " << sess.length << " " << paused;
+    } else if (command == "pause" && !paused) {
+        sess.paused_at = monotonic_now();
+        db.checkpoint_sess(sess.id, sess.elapsed);
+        sess.saved = sess.elapsed;
+        line.finish();
+        std::cout << "Session paused, resume it with 'tm sess resume'"
+                  << std::endl;
+        reply << "Session " << sess.id << " paused";
+    } else if (command == "resume" && paused) {
+        sess.start_time += monotonic_now() - sess.paused_at;
+        sess.paused_at = -1;
+        reply << "Session " << sess.id << " resumed";
+    } else if (command == "pause" || command == "resume") {
+        err = "session " + std::to_string(sess.id) + " is " +
+            (paused ? "already paused" : "not paused");
+    } else if (command == "stop") {
+        sess.stopped = true;
+        sess.stop_fd = fd;
+        return;
+    } else if (command == "extend") {
+        int minutes = 0;
+        args >> minutes;
+        int new_length = extended_length(sess.length, minutes, err);
+        if (new_length > 0) {
+            sess.limit = extended_limit(sess.length, sess.limit, new_length);
+            sess.length = new_length;
+            db.extend_sess(sess.id, sess.length, sess.limit);
+            reply << "Session " << sess.id << " extended to "
+                  << tm_utils::sec_to_time(sess.length) << " (H:MM:SS)";
         }
-        exit(0);
     } else {
-        std::cerr << "\n-i option has been selected, cannot exit until time"
-                  << " is up" << std::endl;
+        err = "unknown session command '" + command + "'";
+    }
+
+    std::string response = err.empty() ? "ok " + reply.str() : "error " + err;
+    tm_utils::write_all(fd, response.data(), response.size());
+    close(fd);
+}
+
+
+// Prints one line of tm sess status
+static void print_status(const tm_db::OpenSess &sess, int elapsed,
+                         int length, bool paused) {
+    std::cout << "Session " << sess.id << " on task " << sess.task_id;
+    if (sess.pid == 0) {
+        std::cout << " (detached): ";
+    } else {
+        std::cout << " (pid " << sess.pid << (paused ? ", paused" : "")
+                  << "): ";
+    }
+    std::cout << tm_utils::sec_to_time(elapsed) << " worked, ";
+    if (elapsed < length) {
+        std::cout << tm_utils::sec_to_time(length - elapsed) << " left";
+    } else {
+        std::cout << tm_utils::sec_to_time(elapsed - length) << " overtime";
     }
+    std::cout << " (H:MM:SS)" << std::endl;
 }
 
 
 /**
- * Description: starts a session
+ * Description: starts a session, every tick of the timer is scheduled from
+ * the instant the session started rather than from the previous tick, and
+ * the length stored is the time that elapsed on the monotonic clock, so
+ * neither drifts when printing or the machine is slow. The session is
+ * written when it starts, and its length is saved every checkpoint seconds,
+ * so at most that much is lost if the process is killed
  * @param[in] sess_length: the amount of time, in min for a session
  * @param[in] no_interrupt: prevents the session from terminating with ^C
  * @param[in] no_overtime: if true, the session ends immediately after the
  * time is over, otherwise it continues for up to 50% more time
  * @param[in] task_id: the task id of the task being worked on
  * @param[in] description: A quick description of the session's goals
+ * @param[in] refresh: the seconds between updates of the progress bar, if 0
+ * it is 1 on a terminal and NO_TTY_REFRESH otherwise
+ * @param[in] checkpoint: the seconds between saves of the length of the
+ * session to the database
+ * @param[in] detach: if true, the session is recorded as started and this
+ * returns immediately, it lasts until handle_stop or its limit
  */
 void tm_sess::handle_start(int sess_length, bool no_interupt,
                            bool no_overtime, int task_id,
-                           const std::string &description) {
-    // Set the global variable to the current start time
-    start = tm_utils::current_datetime() + ":00.000";
+                           const std::string &description, int refresh,
+                           int checkpoint, bool detach) {
+    // A batch holds the write lock until it ends, which would block every
+    // other tm process for as long as the session runs, and keep its
+    // checkpoints from being committed
+    if (tm_batch::running() && !detach) {
+        std::cerr << "ERROR: tm sess start can only run inside of tm batch"
+                  << " with --detach" << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    if (checkpoint <= 0) {
+        std::cerr << "ERROR: '" << checkpoint << "' is an invalid checkpoint"
+                  << " interval, it must be a positive number of seconds"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
 
     if (sess_length <= 0) {
         std::cerr << "ERROR: '" << sess_length << "' is an invalid sess length"
                   << std::endl;
         std::cerr << "The length of the sess must be a positive integer from 1-180"
                   << std::endl;
+        throw tm_utils::CommandError();
     }
 
     if (sess_length > MAX_SESS_LENGTH) {
@@ -120,79 +534,277 @@ void tm_sess::handle_start(int sess_length, bool no_interupt,
     }
 
     // Assert that the id belongs to an incomplete existing task
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     if (!db.valid_task_id(task_id)) {
         std::cerr << "ERROR: '" << task_id
                   << "' is not an id for any current incomplete task."
                   << std::endl;
         std::cerr << "Run 'tm task list --all' to see all current"
                   << " incomplete tasks" << std::endl;
-        exit(1);
-    }
-    sess_task_id = task_id;
-    nointerrupt = no_interupt;
-    sess_desc = description;
-
-    double progress = 0.0;
-    // multiply by 60 since sess_length is in seconds
-    int temp_seconds = sess_length * 60;
-
-    // Initialize mechanism to catch signal
-    signal(SIGINT, handle_signal);
-
-    // Initialize the progress bar with zeros
-    print_bar(0.0, BAR_WIDTH);
-    std::cout << "Time Left: "
-              << tm_utils::sec_to_time(temp_seconds) << " (H:MM:SS)\r";
-    std::cout.flush();
-
-    double increment = static_cast<double>(1.0 / (sess_length * 60));
-    while (progress <= 1.0 && temp_seconds) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-
-        --temp_seconds;
-        ++len;
-        // This is to make sure that progress stops at 100% and doesn't go below
-        // or above due to wierd floating point rounding errors
-        if (!temp_seconds) {
-            progress = 1.0;
+        throw tm_utils::CommandError();
+    }
+
+    // The time of day is only used to record when the session started, how
+    // long it lasted comes from the monotonic clock
+    long long start_epoch = tm_utils::current_epoch();
+    char seconds[16];
+    snprintf(seconds, sizeof(seconds), ":%02d.000", (int) (start_epoch % 60));
+    std::string start = tm_utils::epoch_to_datetime(start_epoch) + seconds;
+    const double start_time = monotonic_now();
+
+    // The session lasts for its length, then up to 50% more in overtime
+    const int length = sess_length * 60;
+    const int limit = no_overtime ? length : length + sess_length * 30;
+
+    if (detach) {
+        for (auto &sess : db.open_sessions()) {
+            if (sess.pid == 0) {
+                std::cerr << "ERROR: session " << sess.id << " is already"
+                          << " detached, stop it with 'tm sess stop'"
+                          << std::endl;
+                throw tm_utils::CommandError();
+            }
+        }
+        int sess_id = db.open_sess(start, task_id, description, length, limit,
+                                   true);
+        std::cout << "Started session " << sess_id << ", it ends by itself in "
+                  << tm_utils::sec_to_time(limit) << " (H:MM:SS)"
+                  << std::endl;
+        return;
+    }
+    RunningSess sess;
+    sess.id = db.open_sess(start, task_id, description, length, limit, false);
+    sess.length = length;
+    sess.limit = limit;
+    sess.start_time = start_time;
+    int control_fd = listen_control(db.sess_socket(sess.id));
+
+    if (pipe(signal_pipe) != 0) {
+        std::cerr << "ERROR: failed to create a pipe for the session"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
+    fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+    auto prev_int_handler = signal(SIGINT, handle_signal);
+    auto prev_winch_handler = signal(SIGWINCH, handle_signal);
+    // A client that gave up on its reply must not kill the session
+    auto prev_pipe_handler = signal(SIGPIPE, SIG_IGN);
+
+    tm_utils::LineRenderer line;
+    if (refresh <= 0) {
+        refresh = line.is_tty() ? 1 : NO_TTY_REFRESH;
+    }
+
+    bool interrupted = false;
+    bool redraw = true;
+    while (true) {
+        bool paused = sess.paused_at >= 0;
+        if (paused || !redraw) {
+            // Nothing changes until the session is resumed, or until the
+            // next frame is due
+        } else if (sess.elapsed < sess.length) {
+            draw_bar(line, sess.elapsed / (double) sess.length,
+                     sess.length - sess.elapsed);
+        } else if (sess.limit > sess.length) {
+            draw_overtime(line, sess.elapsed - sess.length);
+        }
+        if (sess.elapsed >= sess.limit) {
+            break;
+        }
+
+        // The next frame is on the next multiple of refresh since the start,
+        // unless a checkpoint is due, or the session or its overtime ends
+        // before then. A paused session only wakes up for events
+        double deadline = -1;
+        if (!paused) {
+            int next = (sess.elapsed / refresh + 1) * refresh;
+            next = MIN(next, sess.saved + checkpoint);
+            next = MIN(next, sess.elapsed < sess.length ? sess.length
+                                                        : sess.limit);
+            deadline = sess.start_time + next;
+        }
+        int event = wait_until(deadline, control_fd);
+        int now = (int) ((paused ? sess.paused_at : monotonic_now()) -
+                         sess.start_time);
+        // A checkpoint alone doesn't draw a frame, since off a terminal
+        // every frame is a line of its own
+        redraw = event != 0 || now / refresh != sess.elapsed / refresh;
+        if (sess.elapsed < sess.length && now >= sess.length) {
+            // Finish the bar at 100%, before overtime starts
+            draw_bar(line, 1.0, 0);
+            line.finish();
+            redraw = true;
+            // TODO (30/07/2019): Add an alarm to indicate to the user the
+            // session is complete
+        }
+        sess.elapsed = MIN(now, sess.limit);
+        if (sess.elapsed >= sess.saved + checkpoint) {
+            db.checkpoint_sess(sess.id, sess.elapsed);
+            sess.saved = sess.elapsed;
+        }
+
+        if (event == CONTROL_EVENT) {
+            handle_control(db, line, sess, control_fd);
+        } else if (event == SIGWINCH) {
+            line.resize();
+        } else if (event == SIGINT && no_interupt &&
+                   sess.elapsed < sess.length) {
+            line.finish();
+            std::cerr << "-i option has been selected, cannot exit until time"
+                      << " is up" << std::endl;
+        } else if (event == SIGINT) {
+            interrupted = true;
+        }
+        if (interrupted || sess.stopped) {
+            break;
+        }
+    }
+    line.finish();
+    signal(SIGINT, prev_int_handler);
+    signal(SIGWINCH, prev_winch_handler);
+    close(signal_pipe[0]);
+    close(signal_pipe[1]);
+    if (control_fd >= 0) {
+        close(control_fd);
+        unlink(db.sess_socket(sess.id).c_str());
+    }
+
+    int elapsed = sess.elapsed;
+    if (!interrupted && !sess.stopped && elapsed > sess.length) {
+        std::cout << "Overtime limit reached, session closed with a duration "
+                  << "of: " << tm_utils::sec_to_time(elapsed) << std::endl;
+    }
+    // Exclude interrupted sessions less than 60 seconds from the database
+    bool keep = !(interrupted || sess.stopped) || elapsed > 60;
+    db.close_sess(sess.id, elapsed, keep);
+
+    if (sess.stopped) {
+        std::stringstream reply;
+        reply << "ok Session " << sess.id;
+        if (keep) {
+            reply << " closed with a duration of: "
+                  << tm_utils::sec_to_time(elapsed);
         } else {
-            progress += increment;
+            reply << " lasted less than a minute, so it was discarded";
         }
-        progress = MIN(progress, 1.01);
+        std::cout << reply.str().substr(3) << std::endl;
+        tm_utils::write_all(sess.stop_fd, reply.str().data(),
+                            reply.str().size());
+        close(sess.stop_fd);
+    }
+    signal(SIGPIPE, prev_pipe_handler);
+}
+
+
+/**
+ * Description: stops a session, a detached session is closed with the time
+ * since it started, up to its limit, while a session in the foreground is
+ * told to stop through its control socket. Like an interrupted session, it is
+ * discarded if it lasted a minute or less
+ * @param[in] sess_id: the id of the session, or 0 for the latest one
+ */
+void tm_sess::handle_stop(int sess_id) {
+    auto &db = tm_db::shared_db();
+    auto sess = find_session(db, sess_id, false);
+    if (sess.pid != 0) {
+        std::cout << send_control(db, sess.id, "stop") << std::endl;
+        return;
+    }
+
+    int elapsed = MIN(tm_utils::current_epoch() - sess.time_started,
+                      sess.max_length);
+    elapsed = MAX(elapsed, 0);
+    db.close_sess(sess.id, elapsed, elapsed > 60);
+    if (elapsed > 60) {
+        std::cout << "Session " << sess.id << " closed with a duration of: "
+                  << tm_utils::sec_to_time(elapsed) << std::endl;
+    } else {
+        std::cout << "Session " << sess.id << " lasted less than a minute,"
+                  << " so it was discarded" << std::endl;
+    }
+}
+
+
+/**
+ * Description: pauses a session running in the foreground, the time it is
+ * paused for doesn't count towards its length
+ * @param[in] sess_id: the id of the session, or 0 for the latest one
+ */
+void tm_sess::handle_pause(int sess_id) {
+    auto &db = tm_db::shared_db();
+    auto sess = find_session(db, sess_id, true);
+    std::cout << send_control(db, sess.id, "pause") << std::endl;
+}
 
-        // Update progress bar
-        print_bar(progress, BAR_WIDTH);
-        std::cout << "Time Left: "
-                  << tm_utils::sec_to_time(temp_seconds) << " (H:MM:SS)\r";
-        std::cout.flush();
+
+/**
+ * Description: resumes a paused session
+ * @param[in] sess_id: the id of the session, or 0 for the latest one
+ */
+void tm_sess::handle_resume(int sess_id) {
+    auto &db = tm_db::shared_db();
+    auto sess = find_session(db, sess_id, true);
+    std::cout << send_control(db, sess.id, "resume") << std::endl;
+}
+
+
+/**
+ * Description: adds time to the planned length of a session, and to its
+ * overtime if it has any
+ * @param[in] sess_id: the id of the session, or 0 for the latest one
+ * @param[in] minutes: the minutes to add
+ */
+void tm_sess::handle_extend(int sess_id, int minutes) {
+    auto &db = tm_db::shared_db();
+    auto sess = find_session(db, sess_id, false);
+    if (sess.pid != 0) {
+        std::cout << send_control(db, sess.id,
+                                  "extend " + std::to_string(minutes))
+                  << std::endl;
+        return;
     }
-    std::cout << std::endl;
-    // TODO (30/07/2019): Add an alarm to indicate to the user the session
-    // is complete
 
-    if (no_overtime) {
-        db.add_sess(start, len, sess_task_id, sess_desc);
+    std::string err;
+    int new_length = extended_length(sess.length, minutes, err);
+    if (new_length == 0) {
+        std::cerr << "ERROR: " << err << std::endl;
+        throw tm_utils::CommandError();
+    }
+    db.extend_sess(sess.id, new_length,
+                   extended_limit(sess.length, sess.max_length, new_length));
+    std::cout << "Session " << sess.id << " extended to "
+              << tm_utils::sec_to_time(new_length) << " (H:MM:SS)"
+              << std::endl;
+}
+
+
+/**
+ * Description: prints every session that is running, with the time worked
+ * so far and the time left, or the overtime worked. Sessions in the
+ * foreground are asked for their time, since they can be paused
+ */
+void tm_sess::handle_status() {
+    auto &db = tm_db::shared_db();
+    auto sessions = db.open_sessions();
+    if (sessions.empty()) {
+        std::cout << "No sessions are running" << std::endl;
         return;
     }
-    int max_overtime = sess_length * 30;
-    // Allow the user to exit out of overtime
-    nointerrupt = false;
-
-    std::cout << "Overtime amount: "
-              << tm_utils::sec_to_time(0) << " \r";
-    std::cout.flush();
-    for (int i = 0; i < max_overtime; ++i) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        ++len;
-        std::cout << "Overtime amount: "
-                  << tm_utils::sec_to_time(i+1) << " \r";
-        std::cout.flush();
-    }
-    std::cout << std::endl;
-    std::cout << "Overtime limit reached, session closed with a duration "
-              << "of: " << tm_utils::sec_to_time(len) << std::endl;
-    db.add_sess(start, len, sess_task_id, sess_desc);
+    long long now = tm_utils::current_epoch();
+    for (auto &sess : sessions) {
+        std::string reply;
+        if (sess.pid != 0 && request_control(db, sess.id, "status", reply)) {
+            std::istringstream fields(reply);
+            int elapsed, length;
+            bool paused;
+            fields >> elapsed >> length >> paused;
+            print_status(sess, elapsed, length, paused);
+            continue;
+        }
+        // Sessions that can't be asked are assumed to be running unpaused
+        int elapsed = MIN(now - sess.time_started, sess.max_length);
+        print_status(sess, MAX(elapsed, 0), sess.length, false);
+    }
 }
 
 
@@ -205,7 +817,7 @@ void tm_sess::handle_start(int sess_length, bool no_interupt,
  * @param[in] reversed: Display the sessions in reversed chronological order if true
  */
 void tm_sess::handle_log(bool condensed, int max_sessions, bool reversed) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.sess_log(condensed, max_sessions, reversed);
 }
 
@@ -215,7 +827,7 @@ void tm_sess::handle_log(bool condensed, int max_sessions, bool reversed) {
  * @param[in] sess_id, the id of the session to remove
  */
 void tm_sess::handle_remove(int sess_id) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.remove_sess(sess_id);
 }
 
@@ -239,26 +851,26 @@ void tm_sess::handle_add(int sess_length, int task_id,
                          const std::string start_date,
                          const std::string start_time,
                          const std::string &description) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     if (sess_length > 270 || sess_length <= 0) {
         std::cerr << "ERROR: the length of the session must be a"
                   << " positive integer from 1 - 270" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     if (!tm_utils::valid_date(start_date)) {
         std::cerr << "ERROR: '" << start_date 
                   << "' is not valid date." << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     if (!tm_utils::valid_time(start_time)) {
         std::cerr << "ERROR: '" << start_time 
                   << "' is not valid time." << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     std::string date = start_date + " " + start_time;
     if (date > tm_utils::current_datetime()) {
         std::cerr << "ERROR: cannot pick a date in the future." << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     db.add_sess(date + ":00.000", sess_length * 60, 
                 task_id, description);
@@ -3,17 +3,22 @@
 //
 
 
+#include <stdio.h>
+
 #include <ctime>
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <ostream>
 #include <vector>
 #include <sstream>
-#include <unordered_map>
 #include <iomanip>
+#include <cmath>
 #include <chrono>
+#include <utility>
 #include <thread>
+#include <unordered_map>
 
 #include "stat.hpp"
 #include "database.hpp"
@@ -25,6 +30,9 @@
       __typeof__ (b) _b = (b); \
     _a < _b ? _a : _b; })
 
+int rdn(const std::string &date);
+std::string rdn_to_date(int day);
+
 
 /**
  * Description: prints a summar
@@ -49,7 +57,7 @@ void tm_stat::handle_summary(bool sum_tasks, bool sum_all,
         query_until = year + "-12-31";
     } else if (!year.empty()) {
         std::cerr << "ERROR: '" << year << "' is not a valid year!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
 
     // Check from
@@ -57,7 +65,7 @@ void tm_stat::handle_summary(bool sum_tasks, bool sum_all,
         query_from = from;
     } else if (!from.empty()) {
         std::cerr << "ERROR: '" << from << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
 
     // Check from
@@ -65,7 +73,7 @@ void tm_stat::handle_summary(bool sum_tasks, bool sum_all,
         query_until = until;
     } else if (!until.empty()) {
         std::cerr << "ERROR: '" << until << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
 
     // If sum_all, no date restrictions added
@@ -75,48 +83,218 @@ void tm_stat::handle_summary(bool sum_tasks, bool sum_all,
     }
 
     // Get Total
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
 
-    std::unordered_map<std::string, double> data;
+    tm_db::DailySeries data;
     if (sum_tasks) {
-        data = db.stat_task_query(query_from, query_until);
+        db.stat_task_query(query_from, query_until, data);
     } else {
-        data = db.stat_time_query(query_from, query_until);
+        db.stat_time_query(query_from, query_until, data);
     }
-    auto stat = StatHandler(data);
+    auto stat = StatHandler(std::move(data));
     stat.output_summary();
 }
 
 
-void tm_stat::handle_grad() {
-    auto db = tm_db::TMDatabase();
-    auto data = db.stat_time_query("", "");
-    auto stat = StatHandler(data);
-    stat.gradient_map();
+/**
+ * Description: Displays gradient heatmaps of the progress worked on, one for
+ * every task, project and tag given, or a single one for all the data if none
+ * are given. Every group of the same kind is queried in one pass
+ * @param[in] tasks: the ids of the tasks to display
+ * @param[in] projs: the names of the projects to display
+ * @param[in] tags: the names of the tags to display
+ * @param[in] years: display each year from January to December, if empty the
+ * past 52 weeks are displayed
+ * @param[in] metric: "time", "sessions" or "tasks-done"
+ * @param[in] color: the color of the gradient
+ *
+ * Note: the heatmap of all the data is cached along with the sessions, day,
+ * options and terminal width it was rendered for, so it is only rendered
+ * again when one of them changes
+ */
+void tm_stat::handle_grad(const std::vector<int> &tasks,
+                          const std::vector<std::string> &projs,
+                          const std::vector<std::string> &tags,
+                          const std::vector<int> &years,
+                          const std::string &metric,
+                          const std::string &color) {
+    if (metric != "time" && metric != "sessions" && metric != "tasks-done") {
+        std::cerr << "ERROR: '" << metric << "' is not a valid metric!"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
+    if (tm_color::VALID_GRADIENTS.find(color) ==
+            tm_color::VALID_GRADIENTS.end()) {
+        std::cerr << "ERROR: '" << color << "' is not a valid color!"
+                  << std::endl;
+        throw tm_utils::CommandError();
+    }
+
+    // The first and last day of every map, a year is shown from January to
+    // December, otherwise the map ends today and starts on a Sunday
+    int today = tm_utils::current_epoch() / 86400 + EPOCH_RDN;
+    std::vector<std::pair<int, int>> windows;
+    for (int year : years) {
+        std::string jan_1 = std::to_string(year) + "-01-01";
+        if (!tm_utils::valid_date(jan_1)) {
+            std::cerr << "ERROR: '" << year << "' is not a valid year!"
+                      << std::endl;
+            throw tm_utils::CommandError();
+        }
+        windows.emplace_back(rdn(jan_1), rdn(std::to_string(year) + "-12-31"));
+    }
+    if (windows.empty()) {
+        windows.emplace_back(today - 364 - today % 7, today);
+    }
+    int from_day = windows[0].first;
+    int until_day = windows[0].second;
+    for (const auto &window : windows) {
+        from_day = MIN(from_day, window.first);
+        until_day = window.second > until_day ? window.second : until_day;
+    }
+
+    auto &db = tm_db::shared_db();
+
+    // Only the map of all the time or sessions is cached, since it is the
+    // only one that can be keyed on the sessions alone, and an in-memory
+    // database has no directory to cache it in
+    bool filtered = !tasks.empty() || !projs.empty() || !tags.empty();
+    bool use_cache = !filtered && metric != "tasks-done" && !db.dir().empty();
+    std::stringstream key;
+    if (use_cache) {
+        int last_id, num_sess;
+        db.last_sess(last_id, num_sess);
+        key << last_id << ' ' << num_sess << ' ' << today - EPOCH_RDN << ' '
+            << color << ' ' << tm_utils::num_cols();
+        if (metric != "time") {
+            key << ' ' << metric;
+        }
+        for (int year : years) {
+            key << ' ' << year;
+        }
+        key << '\n';
+    }
+
+    // The first line of the cache is the key the map was rendered for
+    std::string cache_file = db.dir() + GRAD_CACHE_FILE;
+    if (use_cache) {
+        std::ifstream cache(cache_file, std::ios::binary);
+        std::string line;
+        if (std::getline(cache, line) && line + '\n' == key.str()) {
+            std::cout << cache.rdbuf();
+            return;
+        }
+    }
+
+    std::string map = key.str();
+    size_t key_len = map.size();
+    map += "Current Day: " + rdn_to_date(today) + "\n";
+
+    // Renders the map of one group for every window, titled by the group and
+    // the year when there is more than one possible map
+    auto render = [&](const std::string &title, tm_db::DailySeries &data) {
+        auto stat = StatHandler(std::move(data));
+        for (size_t i = 0; i < windows.size(); ++i) {
+            std::string label = title;
+            if (!years.empty()) {
+                label += (label.empty() ? "" : ", ") + std::to_string(years[i]);
+            }
+            if (!label.empty()) {
+                map += "\n\033[1;39m" + label + "\033[0m\n";
+            }
+            stat.gradient_map(map, color, windows[i].first, windows[i].second);
+        }
+    };
+
+    std::unordered_map<int, tm_db::DailySeries> series;
+    if (!filtered) {
+        db.stat_grad_query(metric, "", {}, from_day, until_day, series);
+        render("", series[0]);
+    }
+    if (!tasks.empty()) {
+        series.clear();
+        db.stat_grad_query(metric, "task", tasks, from_day, until_day, series);
+        for (int id : tasks) {
+            render("Task " + std::to_string(id), series[id]);
+        }
+    }
+    if (!projs.empty()) {
+        std::vector<int> ids;
+        for (const auto &proj : projs) {
+            ids.push_back(db.proj_id(proj));
+            if (ids.back() == -1) {
+                std::cerr << "ERROR: '" << proj << "' is not an existing project!"
+                          << std::endl;
+                throw tm_utils::CommandError();
+            }
+        }
+        series.clear();
+        db.stat_grad_query(metric, "proj", ids, from_day, until_day, series);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            render("Project: " + projs[i], series[ids[i]]);
+        }
+    }
+    if (!tags.empty()) {
+        std::vector<int> ids;
+        for (const auto &tag : tags) {
+            ids.push_back(db.tag_id(tag));
+            if (ids.back() == -1) {
+                std::cerr << "ERROR: '" << tag << "' is not an existing tag!"
+                          << std::endl;
+                throw tm_utils::CommandError();
+            }
+        }
+        series.clear();
+        db.stat_grad_query(metric, "tag", ids, from_day, until_day, series);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            render("Tag: " + tags[i], series[ids[i]]);
+        }
+    }
+    std::cout.write(map.data() + key_len, map.size() - key_len);
+    if (!use_cache) { return; }
+
+    // Written to a temporary file first, so a concurrent tm never reads a
+    // partially written cache
+    std::string tmp_file = cache_file + ".tmp";
+    std::ofstream out(tmp_file, std::ios::binary);
+    out.write(map.data(), map.size());
+    out.close();
+    if (!out.fail()) {
+        rename(tmp_file.c_str(), cache_file.c_str());
+    }
 }
 
 /**
- * @param[in] data: a map that maps dates -> values
+ * @param[in] data: the value of every day, moved into the handler
  */
-tm_stat::StatHandler::StatHandler(const std::unordered_map<
-                                  std::string, double> &data) {
-    this->data_ = data;
+tm_stat::StatHandler::StatHandler(tm_db::DailySeries data)
+    : data_(std::move(data)) {
     this->load_vals();
 }
 
 
 /**
- * Description: loads all the values from data_ into vals_
+ * Description: computes all the statistics over data_ in one pass, the first
+ * and last days of a series always have data
  */
 inline void tm_stat::StatHandler::load_vals() {
-    for (auto const& it : this->data_) {
-        if (this->min_date.empty() || this->min_date > it.first) {
-            this->min_date = it.first;
+    this->min_day = this->data_.first_day;
+    this->max_day = this->data_.last_day();
+    int streak = 0;
+    for (int day = this->min_day; day <= this->max_day; ++day) {
+        double val = this->data_.values[day - this->min_day];
+        if (std::isnan(val)) {
+            streak = 0;
+            continue;
         }
-        if (this->max_date.empty() || this->max_date < it.first) {
-            this->max_date = it.first;
+        this->stats_.add(val);
+        // Day 1 of the Rata Die was a Monday
+        this->weekday_sum_[day % 7] += val;
+        ++this->weekday_count_[day % 7];
+        if (++streak > this->streak_len_) {
+            this->streak_len_ = streak;
+            this->streak_end_ = day;
         }
-        this->vals_.push_back(it.second);
     }
 }
 
@@ -130,7 +308,7 @@ inline void tm_stat::StatHandler::load_vals() {
 int rdn(const std::string &date) {
     if (!tm_utils::valid_date(date)) {
         std::cerr << "Error: '" << date << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     int y = stoi(date.substr(0, 4));
     int m = stoi(date.substr(5, 2));
@@ -143,11 +321,13 @@ int rdn(const std::string &date) {
 }
 
 /**
- * Description: Returns the number of days between date1 and date2
- * date1 and date2 both need to be valid dates of the form YYYY-MM-DD
+ * Description: Convert a Rata Die back into a date
+ * @param[in] day: the Rata Die of the date
+ * @return Returns the date in 'YYYY-MM-DD' Format
  */
-inline int day_diff(const std::string &date1, const std::string &date2) {
-    return rdn(date2) - rdn(date1);
+std::string rdn_to_date(int day) {
+    return tm_utils::epoch_to_datetime(
+            (long long) (day - EPOCH_RDN) * 86400).substr(0, 10);
 }
 
 /**
@@ -158,192 +338,136 @@ inline int day_diff(const std::string &date1, const std::string &date2) {
  * observed
  */
 void tm_stat::StatHandler::output_summary(std::ostream &out) {
-    if (this->vals_.empty()) { return; }
+    if (this->stats_.count() == 0) { return; }
 
-    auto mean = tm_math::mean(this->vals_);
-    auto stdev = tm_math::standard_dev(this->vals_, mean);
-    auto total_days = day_diff(this->min_date, this->max_date);
+    auto mean = this->stats_.mean();
+    auto stdev = this->stats_.standard_dev();
+    auto total_days = this->max_day - this->min_day;
     total_days = total_days == 0 ? 1 : total_days;
 
-    auto total_mean = (mean * this->vals_.size()) / total_days;
+    auto total_mean = (mean * this->stats_.count()) / total_days;
 
     out << "\033[1;4;39mDisplaying Statistical Summary\033[0m" << std::endl;
     out << "Observing data from:" << std::endl;
-    out << "Earliest datapoint: '" << this->min_date << "'\n";
-    out << "Latest datapoint: '" << this->max_date << "'\n\n";
+    out << "Earliest datapoint: '" << rdn_to_date(this->min_day) << "'\n";
+    out << "Latest datapoint: '" << rdn_to_date(this->max_day) << "'\n\n";
     out << "Total days in between: " << total_days << std::endl;
     out << "Average value for days is: " << std::setw(2) << mean << std::endl;
     out << "Standard deviation: " << std::setw(2) << stdev << std::endl;
     out << "Average value for all days: " << std::setw(2) << total_mean << std::endl;
-    out << "Total number of datapoints observed: " << this->vals_.size()
+    out << "Median value for days: " << std::setw(2)
+        << this->stats_.quantile(0.5) << std::endl;
+    out << "90th percentile for days: " << std::setw(2)
+        << this->stats_.quantile(0.9) << std::endl;
+    out << "Total number of datapoints observed: " << this->stats_.count()
         << std::endl;
+    out << "Longest streak: " << this->streak_len_ << " days, from '"
+        << rdn_to_date(this->streak_end_ - this->streak_len_ + 1) << "' to '"
+        << rdn_to_date(this->streak_end_) << "'\n\n";
+
+    const std::vector<std::string> DAYS = {"Sun", "Mon", "Tue", "Wed",
+                                           "Thu", "Fri", "Sat"};
+    out << "Average value by day of the week:" << std::endl;
+    for (int i = 0; i < 7; ++i) {
+        double avg = 0.0;
+        if (this->weekday_count_[i] > 0) {
+            avg = this->weekday_sum_[i] / this->weekday_count_[i];
+        }
+        out << DAYS[i] << ": " << std::setw(2) << avg << std::endl;
+    }
 }
 
 
 /**
- * Description: Returns the current day of the week, 0 is Monday, 6 is Sunday
- */
-inline int cur_day_of_week() {
-    time_t rawtime;
-    tm * timeinfo;
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    return timeinfo->tm_wday;
-}
-
-
-/**
- * Description: Operator overload to allow for chrono timestamps
- * to be converted to strings
- * @param[in] os: the output stream to send the output to
- * @param[in] timep: the time_point as calculated from convert_to_timepoint
- * @return Returns
- */
-template <typename Clock, typename Duration>
-std::ostream& operator<<(std::ostream& os,
-        const std::chrono::time_point<Clock, Duration>& timep) {
-
-    auto converted_timep = Clock::to_time_t(timep);
-    os << std::put_time(std::localtime(&converted_timep), "%Y-%m-%d");
-    return os;
-}
-
-/**
- * Description: Returns a new time_point based on how many days to add,
- * note that if days_to_add is a negative number, then it will subtract days
- *
- * @param[in] timepoint: a time_point object
- * @param[in] days_to_add: The number of days to add
- * @return Returns a new time_point shifted by the specified amount of days
- */
-template <typename Clock, typename Duration>
-auto add_days(const std::chrono::time_point<Clock, Duration>& timepoint,
-              int days_to_add) {
-    constexpr std::time_t seconds_in_day = 60 * 60 * 24;
-    //                                     mm   hh   dd
-
-    std::time_t days = seconds_in_day * days_to_add;
-    auto date = Clock::to_time_t(timepoint);
-    return Clock::from_time_t(date + days);
-}
-
-
-/**
- * Description: converts 3 integers into a time_point object, which
- * allows for easy manipulation across datetime
- * @param[in] years: integer that is greater than 1900 ideally
- * @param[in] months: a value from 1 - 12
- * @param[in] days: a value from 1 - 31
- * @return Returns a time_point object
- */
-auto convert_to_timepoint(int years, int months, int days) {
-    --months; // Months needs to be from 0-11 not 1-12
-    years -= 1900;
-    std::tm date = {};
-    date.tm_year = years;
-    date.tm_mon = months;
-    date.tm_mday = days;
-    return std::chrono::system_clock::from_time_t(std::mktime(&date));
-}
-
-
-/**
-* Description: Prints a gradient map of your progress, in a similar style to
-* Github with its contribution chart
+* Description: Renders a gradient map of your progress, in a similar style to
+* Github with its contribution chart, the whole map is built in buf and uses
+* integer day numbers for all the calendar math
+* @param[out] buf: the rendered map is appended to buf
 * @param[in] color: the color of the gradient, must be a valid color from the
 * tm_color::VALID_GRADIENTS set
+* @param[in] first_day: the Rata Die of the first day shown
+* @param[in] last_day: the Rata Die of the last day shown
 */
-void tm_stat::StatHandler::gradient_map(std::string color, std::ostream &out) {
-
-    std::string now = tm_utils::current_datetime().substr(0, 10);
-
-    int year = stoi(now.substr(0, 4));
-    int month = stoi(now.substr(5, 2));
-    int day = stoi(now.substr(8, 2));
-
-    out << "Current Day: " << now << std::endl;
-
-    auto date = convert_to_timepoint(year, month, day);
-
-    double min_val = 0xfffff;
-    double max_val = -1;
-    for (auto const& it : this->data_) {
-        if (it.second <= min_val) {
-            min_val = it.second;
-        }
-        if (it.second >= max_val) {
-            max_val = it.second;
-        }
-    }
-
-    //Normalize the values between 0 and 1
-    for (auto it = this->data_.begin(); it != this->data_.end(); it++) {
-        it->second = tm_math::normalize(it->second, min_val, max_val);
-    }
-
-    ssize_t grad_size = tm_color::GRADIENTS.find(color)->second.size();
-
+void tm_stat::StatHandler::gradient_map(std::string &buf,
+                                        const std::string &color,
+                                        int first_day, int last_day) {
+    // The map starts on the Sunday of the week of first_day, day 1 of the
+    // Rata Die was a Monday, so Sundays are the multiples of 7
+    int start_day = first_day - first_day % 7;
+
+    double min_val = this->stats_.min();
+    double max_val = this->stats_.max();
+
+    const std::vector<int> &gradient = tm_color::GRADIENTS.find(color)->second;
+    int grad_size = gradient.size();
     double interval = 1.0 / grad_size;
 
-    std::vector<std::string> progress;
-    constexpr int full_weeks = 52 * 7;
-    for (int i = full_weeks + cur_day_of_week(); i >= 0; --i) {
-        std::stringstream ss;
-        ss << add_days(date, -i);
-        std::string iter_date = ss.str();
-        auto it = this->data_.find(iter_date);
-        if (it == this->data_.end()) {
-            progress.push_back("▦ ");
+    // Every cell of the map, with the color codes formatted once per shade
+    std::vector<std::string> shades;
+    for (int code : gradient) {
+        shades.push_back("\033[38;5;" + std::to_string(code) + "m▦ \033[0m");
+    }
+    const std::string empty = "▦ ";
+
+    // The score of every day shown, oldest first, -1 if it has no data and
+    // -2 if it comes before first_day
+    const int num_days = last_day - start_day + 1;
+    std::vector<int> scores(num_days);
+    for (int i = 0; i < num_days; ++i) {
+        double val = this->data_.get(start_day + i);
+        if (start_day + i < first_day) {
+            scores[i] = -2;
+        } else if (std::isnan(val)) {
+            scores[i] = -1;
         } else {
-            int score = MIN(static_cast<int>(this->data_[iter_date] / interval),
-                            grad_size - 1);
-
-            std::stringstream ss_format;
-            auto temp_val = tm_color::GRADIENTS.find(color)->second[score];
-            ss_format << "\033[38;5;" << temp_val << "m"
-                      << "▦ " << "\033[0m";
-            progress.push_back(ss_format.str());
+            //Normalize the value between 0 and 1
+            val = tm_math::normalize(val, min_val, max_val);
+            scores[i] = MIN(static_cast<int>(val / interval), grad_size - 1);
         }
     }
 
-    const std::vector<std::string> DAYS = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-    const std::vector<std::string> MONTHS = {"Jan ", "Feb ", "Mar ", "Apr ", "May ", "Jun ",
-                                             "Jul ", "Aug ", "Sep ", "Oct ", "Nov ", "Dec"};
+    const char *DAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    const char *MONTHS[] = {"Jan ", "Feb ", "Mar ", "Apr ", "May ", "Jun ",
+                            "Jul ", "Aug ", "Sep ", "Oct ", "Nov ", "Dec"};
+
+    buf.reserve(buf.size() + num_days * shades[0].size() + 1024);
 
-    out << "Less ";
-    for (int i = 0; i < grad_size; ++i) {
-        auto temp_val = tm_color::GRADIENTS.find(color)->second[i];
-            out << "\033[38;5;" << temp_val << "m▦ " << "\033[0m";
+    buf += "Less ";
+    for (auto const &shade : shades) {
+        buf += shade;
     }
-    out << "More" << std::endl;
+    buf += "More\n";
 
     // Print Month bar
-    out << "Month: ";
+    buf += "Month: ";
+    int year, month, day;
+    tm_utils::civil_from_days(last_day - EPOCH_RDN, year, month, day);
     int cur_month = month;
     int num_months = 0;
-    std::string month_out;
-    for (int i = progress.size() / 7; i >= 0; --i) {
-        std::stringstream ss;
-        ss << add_days(date, i * -7);
-        month = stoi(ss.str().substr(5, 2));
-        day = stoi(ss.str().substr(8, 2));
+    for (int i = num_days / 7; i >= 0; --i) {
+        tm_utils::civil_from_days(last_day - i * 7 - EPOCH_RDN,
+                                  year, month, day);
         if (cur_month != month && !(cur_month == 0 && month == 12)) {
-            month_out = MONTHS[month - 1];
-            out << month_out;
+            buf += MONTHS[month - 1];
             cur_month = month % 12;
             num_months++;
         }
         else if (day > 13 && num_months != 12) {
-            out << "  ";
+            buf += "  ";
         }
     }
-    out << std::endl;
+    buf += "\n";
 
     for (int j = 0; j < 7; ++j) {
-        out << DAYS[j] << ":   ";
-        for (int i = j; i < progress.size(); i+= 7) {
-            out << progress[i];
+        buf += DAYS[j];
+        buf += ":   ";
+        for (int i = j; i < num_days; i += 7) {
+            if (scores[i] == -2) {
+                buf += "  ";
+            } else {
+                buf += scores[i] < 0 ? empty : shades[scores[i]];
+            }
         }
-        out << "\033[0m" << std::endl;
+        buf += "\033[0m\n";
     }
 }
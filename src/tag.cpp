@@ -20,7 +20,7 @@
  * that even if other tasks used the tag, it would still be removed
  */
 void tm_tag::handle_rm(const std::string &tag_name, bool hard){
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.remove_tag(tag_name, hard);
 }
 
@@ -37,16 +37,16 @@ void tm_tag::handle_add(const std::string &tag_name, std::string color){
         std::cerr << "ERROR: Name of tag, '" << tag_name 
                   << "' exceeds the maximum length of " << MAX_TAG_LENGTH 
                   << " characters." << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     // check to make sure that the color is valid,
     auto it = tm_color::VALID_COLORS.find(color);
     if (it == tm_color::VALID_COLORS.end()) {
         std::cerr << "ERROR: '" << color
                   << "' is not a valid color" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     tm_db::Tag tag = {tag_name, color};
     db.insert_tag(tag);
 }
@@ -59,6 +59,6 @@ void tm_tag::handle_add(const std::string &tag_name, std::string color){
  * valid ansi color code if the color is valid
  */
 void tm_tag::handle_list(bool no_color, int max_tags){
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.list_tags(no_color, max_tags);
 }
@@ -18,7 +18,7 @@
  * sessions
  */
 void tm_task::handle_rm(int task_id, bool hard) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.remove_task(task_id, hard);
 }
 
@@ -29,14 +29,14 @@ void tm_task::handle_rm(int task_id, bool hard) {
  * @param[in] reversed: if true, set the task to be incomplete
  */
 void tm_task::handle_done(int task_id, bool reversed) {
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     if (!db.valid_task_id(task_id) && !reversed) {
         std::cerr << "'" << task_id 
                   << "' is not an id for any current incomplete task." 
                   << std::endl;
         std::cerr << "It is possible the task is already complete." << std::endl;
         std::cerr << "To check, run 'tm task list -c'" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     db.complete_task(task_id, reversed ? 0 : 1);
 }
@@ -59,16 +59,16 @@ void tm_task::handle_add(const std::string &task_name,
     if (!tm_utils::valid_date(due_date)) {
         std::cerr << "ERROR: '" << due_date
                   << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     } else if (!tm_utils::valid_time(due_time)) {
         std::cerr << "ERROR: '" << due_time
                   << "' is not a valid time!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     std::string due = due_date + " " + due_time + ":00.000";
 
-    tm_db::Task task = {task_name, proj_name, due, tags};
-    auto db = tm_db::TMDatabase();
+    tm_db::Task task = {task_name, proj_name, due, tags, 0, ""};
+    auto &db = tm_db::shared_db();
     db.add_task(task);
 }
 
@@ -99,19 +99,19 @@ void tm_task::handle_list(bool list_long, int max_tasks, bool display_done,
     if (!specified_date.empty() && !tm_utils::valid_date(specified_date)) {
         std::cerr << "ERROR: '" << specified_date
                   << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     if (!date_from.empty() && !tm_utils::valid_date(date_from)) {
         std::cerr << "ERROR: '" << date_from
                   << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
     if (!date_till.empty() && !tm_utils::valid_date(date_till)) {
         std::cerr << "ERROR: '" << date_till
                   << "' is not a valid date!" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
     }
-    auto db = tm_db::TMDatabase();
+    auto &db = tm_db::shared_db();
     db.list_tasks(list_long, max_tasks, display_done, reversed,
                   specified_tags, specified_date, date_from, 
                   date_till, specified_proj);
@@ -6,16 +6,38 @@
 #include <string>
 
 #include "tm.hpp"
+#include "database.hpp"
+#include "utils.hpp"
 
 
-// Defines the main routine for tm, this function defines all the
-// possible CLI options and subcommands for proper argument parsing
+// Defines the main routine for tm, commands are forwarded to tm serve if it
+// is running, otherwise they run through tm_cli::run, which exits with
+// status 1 once a command has reported an error
 int main(int argc, char **argv) {
+    int status;
+    if (tm_serve::forward(argc, argv, status)) {
+        return status;
+    }
+    try {
+        return tm_cli::run(argc, argv);
+    } catch (const tm_utils::CommandError &) {
+        return 1;
+    }
+}
+
+
+// Runs a single tm command, this function defines all the possible CLI
+// options and subcommands for proper argument parsing, the app is built
+// again for every command so that no option carries over to the next one
+int tm_cli::run(int argc, char **argv) {
     CLI::App app{tm_cli::DESCRIPTION};
     app.require_subcommand(0, 1);
 
     bool v_flag = false;
     app.add_flag("--version,-v", v_flag, tm_cli::VERSION_FLAG_DESCRIPTION);
+    // Set as soon as it is parsed, before any subcommand opens the database
+    app.add_option_function<std::string>("--db", tm_db::set_db_path,
+            tm_cli::DB_FLAG_DESCRIPTION);
 
     auto session = app.add_subcommand("sess", tm_cli::SESSION_DESCRIPTION);
     session->require_subcommand(1);
@@ -26,6 +48,9 @@ int main(int argc, char **argv) {
     int sess_length = DEFAULT_SESS_LENGTH;
     bool no_interupt = false;
     bool no_overtime = false;
+    int refresh = 0;
+    int checkpoint = DEFAULT_CHECKPOINT;
+    bool detach = false;
     auto session_start = session->add_subcommand("start",
             tm_sess::START_DESCRIPTION);
     session_start->add_option("--task,-t",
@@ -38,11 +63,60 @@ int main(int argc, char **argv) {
             tm_sess::OVERTIME_DESCRIPTION);
     session_start->add_option("--description,-d",
             sess_desc, tm_sess::DESC_DESCRIPTION);
+    session_start->add_option("--refresh,-r",
+            refresh, tm_sess::REFRESH_DESCRIPTION);
+    session_start->add_option("--checkpoint,-c",
+            checkpoint, tm_sess::CHECKPOINT_DESCRIPTION, true);
+    session_start->add_flag("--detach,-D", detach,
+            tm_sess::DETACH_DESCRIPTION);
     session_start->callback( [&]() {
             tm_sess::handle_start(sess_length, no_interupt, no_overtime,
-                                  task_id, sess_desc);
+                                  task_id, sess_desc, refresh, checkpoint,
+                                  detach);
+    });
+
+    // Define sess stop, pause, resume and extend
+    int control_id = 0;
+    auto session_stop = session->add_subcommand("stop",
+            tm_sess::STOP_DESCRIPTION);
+    session_stop->add_option("--id,-i",
+            control_id, tm_sess::CONTROL_ID_DESCRIPTION);
+    session_stop->callback( [&]() {
+            tm_sess::handle_stop(control_id);
     });
 
+    auto session_pause = session->add_subcommand("pause",
+            tm_sess::PAUSE_DESCRIPTION);
+    session_pause->add_option("--id,-i",
+            control_id, tm_sess::CONTROL_ID_DESCRIPTION);
+    session_pause->callback( [&]() {
+            tm_sess::handle_pause(control_id);
+    });
+
+    auto session_resume = session->add_subcommand("resume",
+            tm_sess::RESUME_DESCRIPTION);
+    session_resume->add_option("--id,-i",
+            control_id, tm_sess::CONTROL_ID_DESCRIPTION);
+    session_resume->callback( [&]() {
+            tm_sess::handle_resume(control_id);
+    });
+
+    int extend_length;
+    auto session_extend = session->add_subcommand("extend",
+            tm_sess::EXTEND_DESCRIPTION);
+    session_extend->add_option("--id,-i",
+            control_id, tm_sess::CONTROL_ID_DESCRIPTION);
+    session_extend->add_option("--length,-l",
+            extend_length, tm_sess::EXTEND_LENGTH_DESCRIPTION)->required();
+    session_extend->callback( [&]() {
+            tm_sess::handle_extend(control_id, extend_length);
+    });
+
+    // Define sess status
+    auto session_status = session->add_subcommand("status",
+            tm_sess::STATUS_DESCRIPTION);
+    session_status->callback(tm_sess::handle_status);
+
     // Define sess add
     std::string time_started = "00:00";
     std::string date_started;
@@ -175,7 +249,7 @@ int main(int argc, char **argv) {
                     (!date_from.empty() || !date_till.empty())){
                 std::cerr << "ERROR: cannot set both --date and either"
                           << " --from or --after options" << std::endl;
-                exit(1);
+                throw tm_utils::CommandError();
             }
             tm_task::handle_list(list_long, max_tasks,
                                  display_complete,
@@ -276,7 +350,7 @@ int main(int argc, char **argv) {
 
     auto stat_sum = stat->add_subcommand("sum", tm_stat::SUM_DESCRIPTION);
     stat_sum->add_flag("--task,-t", sum_task, tm_stat::TASK_DESCRIPTION);
-    stat_sum->add_flag("--all,-a", sum_task, tm_stat::ALL_DESCRIPTION);
+    stat_sum->add_flag("--all,-a", sum_all, tm_stat::ALL_DESCRIPTION);
     stat_sum->add_option("--year,-y", sum_year, tm_stat::YEAR_DESCRIPTION);
     stat_sum->add_option("--from,-f", sum_from, tm_stat::FROM_DESCRIPTION);
     stat_sum->add_option("--until,-u", sum_utill, tm_stat::UNTIL_DESCRIPTION);
@@ -285,20 +359,84 @@ int main(int argc, char **argv) {
                         || !sum_utill.empty())) {
                 std::cerr << "ERROR: cannot specify '--all' flag along with"
                           << " --year/--from/--until"<< std::endl;
-                exit(1);
+                throw tm_utils::CommandError();
             }
             tm_stat::handle_summary(sum_task, sum_all, sum_year,
                                     sum_from, sum_utill);
     });
 
     // Define stat grad
+    std::vector<int> grad_tasks, grad_years;
+    std::vector<std::string> grad_projs, grad_tags;
+    std::string grad_metric = "time", grad_color = "green";
     auto stat_grad = stat->add_subcommand("grad", tm_stat::GRAD_DESCRIPTION);
-    //stat_grad->add_flag("--task,-t", sum_task, tm_stat::TASK_DESCRIPTION);
-    //stat_grad->add_option("--year,-y", sum_year, tm_stat::YEAR_DESCRIPTION);
+    stat_grad->add_option("--task,-t", grad_tasks,
+            tm_stat::GRAD_TASK_DESCRIPTION);
+    stat_grad->add_option("--proj,-p", grad_projs,
+            tm_stat::GRAD_PROJ_DESCRIPTION);
+    stat_grad->add_option("--tag,-g", grad_tags,
+            tm_stat::GRAD_TAG_DESCRIPTION);
+    stat_grad->add_option("--year,-y", grad_years,
+            tm_stat::GRAD_YEAR_DESCRIPTION);
+    stat_grad->add_option("--metric,-m", grad_metric,
+            tm_stat::METRIC_DESCRIPTION);
+    stat_grad->add_option("--color,-c", grad_color,
+            tm_stat::COLOR_DESCRIPTION);
     stat_grad->callback( [&]() {
-        // TODO: add task id so that gradient will display stuff only for a specific task or proj
-        // Add Stathandler derived classes for the different task completion / sess length
-        tm_stat::handle_grad();
+        tm_stat::handle_grad(grad_tasks, grad_projs, grad_tags, grad_years,
+                             grad_metric, grad_color);
+    });
+
+    // Define tm import
+    std::string import_file, import_format;
+    auto import = app.add_subcommand("import", tm_cli::IMPORT_DESCRIPTION);
+    import->add_option("--file,-f", import_file,
+            tm_import::FILE_DESCRIPTION);
+    import->add_option("--format,-F", import_format,
+            tm_import::FORMAT_DESCRIPTION);
+    import->callback( [&]() {
+            tm_import::handle_import(import_file, import_format);
+    });
+
+    // Define tm export
+    std::string export_file, export_format;
+    auto export_cmd = app.add_subcommand("export", tm_cli::EXPORT_DESCRIPTION);
+    export_cmd->add_option("--file,-f", export_file,
+            tm_export::FILE_DESCRIPTION);
+    export_cmd->add_option("--format,-F", export_format,
+            tm_export::FORMAT_DESCRIPTION);
+    export_cmd->callback( [&]() {
+            tm_export::handle_export(export_file, export_format);
+    });
+
+    // Define tm db
+    auto db_cmd = app.add_subcommand("db", tm_cli::DB_DESCRIPTION);
+    db_cmd->require_subcommand(1);
+
+    // Define db analyze
+    auto db_analyze = db_cmd->add_subcommand("analyze",
+            tm_db_cmd::ANALYZE_DESCRIPTION);
+    db_analyze->callback( [&]() {
+            tm_db_cmd::handle_analyze();
+    });
+
+    // Define db rebuild
+    auto db_rebuild = db_cmd->add_subcommand("rebuild",
+            tm_db_cmd::REBUILD_DESCRIPTION);
+    db_rebuild->callback( [&]() {
+            tm_db_cmd::handle_rebuild();
+    });
+
+    // Define tm batch
+    auto batch = app.add_subcommand("batch", tm_cli::BATCH_DESCRIPTION);
+    batch->callback( [&]() {
+            tm_batch::handle_batch();
+    });
+
+    // Define tm serve
+    auto serve = app.add_subcommand("serve", tm_cli::SERVE_DESCRIPTION);
+    serve->callback( [&]() {
+            tm_serve::handle_serve();
     });
 
     CLI11_PARSE(app, argc, argv);
@@ -6,8 +6,11 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdlib.h> 
+#include <stdio.h>
 #include <ctime>
 #include <pwd.h>
+#include <signal.h>
+#include <errno.h>
 
 
 #include <string>
@@ -16,6 +19,8 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <cmath>
+#include <algorithm>
 #include <type_traits>
 #include <chrono>
 #include <thread>
@@ -36,8 +41,7 @@
  */
 bool tm_utils::folder_exists(std::string foldername) {
     struct stat st;
-    stat(foldername.c_str(), &st);
-    return st.st_mode & S_IFDIR;
+    return stat(foldername.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
 }
 
 /**
@@ -72,8 +76,10 @@ int tm_utils::mkdir(const char *path) {
     while (std::getline(ss, level, '/'))
     {
         current_level += level; // append folder to the current level
-        // create current level
-        if (!folder_exists(current_level) && _mkdir(current_level.c_str()) != 0)
+        // create current level, the empty level before a leading slash is
+        // the root, which always exists
+        if (!level.empty() && !folder_exists(current_level) &&
+                _mkdir(current_level.c_str()) != 0)
             return -1;
         current_level += "/"; // don't forget to append a slash
     }
@@ -95,6 +101,19 @@ std::string tm_utils::home_dir() {
 }
 
 
+/**
+ * Returns the name of the host tm is running on
+ * @return the host name, or an empty string if it is unknown
+ */
+std::string tm_utils::host_name() {
+    char name[256] = "";
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+        return "";
+    }
+    return name;
+}
+
+
 /**
  * Description: checks to see if the date specified is valid
  * @param[in] m: the month, returned as a number from 1-12
@@ -212,6 +231,103 @@ std::string tm_utils::current_datetime() {
 }
 
 
+// Number of days from 1970-01-01 to a date in the proleptic Gregorian
+// calendar, years are counted from March so that leap days come last
+// Reference: http://howardhinnant.github.io/date_algorithms.html
+static long long days_from_civil(long long y, int m, int d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+
+/**
+ * Description: converts a number of days since 1970-01-01 into a date, the
+ * inverse of days_from_civil
+ * @param[in] days: the days since 1970-01-01
+ * @param[out] year: the year of the date
+ * @param[out] month: the month of the date, from 1-12
+ * @param[out] day: the day of the month, from 1-31
+ */
+void tm_utils::civil_from_days(long long days, int &year, int &month,
+                               int &day) {
+    days += 719468;
+    long long era = (days >= 0 ? days : days - 146096) / 146097;
+    long long doe = days - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = yoe + era * 400 + (month <= 2);
+}
+
+
+/**
+ * Description: converts a date and time into the number of seconds since
+ * 1970-01-01 00:00, which is how dates are stored in the database. Dates
+ * are kept in local time without a timezone, the same way they are shown,
+ * so every day spans exactly 86400 seconds
+ * @param[in] datetime: YYYY-MM-DD, optionally followed by HH:MM or
+ * HH:MM:SS.SSS, the date must already be valid
+ * @return Returns the seconds since the epoch
+ */
+long long tm_utils::to_epoch(const std::string &datetime) {
+    long long days = days_from_civil(stoi(datetime.substr(0, 4)),
+                                     stoi(datetime.substr(5, 2)),
+                                     stoi(datetime.substr(8, 2)));
+    long long seconds = 0;
+    if (datetime.size() >= 16) {
+        seconds += stoi(datetime.substr(11, 2)) * 3600
+            + stoi(datetime.substr(14, 2)) * 60;
+    }
+    if (datetime.size() >= 19) {
+        seconds += stoi(datetime.substr(17, 2));
+    }
+    return days * 86400 + seconds;
+}
+
+
+/**
+ * Description: converts seconds since the epoch, as returned by to_epoch,
+ * back into a date and time
+ * @param[in] epoch: the seconds since 1970-01-01 00:00
+ * @return Returns a string of the form YYYY-MM-DD HH:MM
+ */
+std::string tm_utils::epoch_to_datetime(long long epoch) {
+    long long days = epoch / 86400;
+    long long secs = epoch % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        --days;
+    }
+    int year, month, day;
+    tm_utils::civil_from_days(days, year, month, day);
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d",
+             year, month, day, (int) (secs / 3600), (int) (secs % 3600 / 60));
+    return buffer;
+}
+
+
+/**
+ * Description: returns the current local date and time in seconds since
+ * the epoch, in the same way as to_epoch
+ */
+long long tm_utils::current_epoch() {
+    time_t rawtime;
+    time(&rawtime);
+    struct tm *timeinfo = localtime(&rawtime);
+    return days_from_civil(timeinfo->tm_year + 1900, timeinfo->tm_mon + 1,
+                           timeinfo->tm_mday) * 86400
+        + timeinfo->tm_hour * 3600 + timeinfo->tm_min * 60 + timeinfo->tm_sec;
+}
+
+
 /**
  * Description: creates a string out of the number of seconds 
  * @param[in] num_seconds: the number of seconds to convert
@@ -283,7 +399,328 @@ void tm_utils::remove_file(std::string file_name) {
     if(remove(file_name.c_str()) != 0) {
         std::cerr << "ERROR: Failed to remove file: '"
                   << file_name << "'" << std::endl;
-        exit(1);
+        throw tm_utils::CommandError();
+    }
+#endif
+}
+
+
+/**
+ * Description: checks if a file name ends with an extension
+ * @param[in] file_name: the name of the file
+ * @param[in] ext: the extension, including the '.'
+ * @return true if file_name ends with ext
+ */
+bool tm_utils::has_extension(const std::string &file_name,
+                             const std::string &ext) {
+    return file_name.size() > ext.size() &&
+        file_name.compare(file_name.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+
+/**
+ * Description: removes the whitespace at both ends of a string
+ * @param[in] str: the string to trim
+ * @return a copy of str without leading or trailing whitespace
+ */
+std::string tm_utils::trim(const std::string &str) {
+    const char *whitespace = " \t\r\n";
+    size_t start = str.find_first_not_of(whitespace);
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = str.find_last_not_of(whitespace);
+    return str.substr(start, end - start + 1);
+}
+
+
+/**
+ * Description: splits a command line into words in the same way as a shell,
+ * words are separated by whitespace and can be quoted with ' or ", and a \
+ * outside of single quotes escapes the next character
+ * @param[in] line: the command line to split
+ * @param[out] args: the words of the line are appended to args
+ * @return false if the line ends inside of a quote
+ */
+bool tm_utils::split_args(const std::string &line,
+                          std::vector<std::string> &args) {
+    std::string word;
+    bool in_word = false;
+    char quote = '\0';
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quote == '\'' && c != '\'') {
+            word += c;
+        } else if (c == '\\' && i + 1 < line.size()) {
+            word += line[++i];
+            in_word = true;
+        } else if (quote != '\0' && c == quote) {
+            quote = '\0';
+        } else if (quote == '\0' && (c == '\'' || c == '"')) {
+            quote = c;
+            in_word = true;
+        } else if (quote == '\0' && isspace((unsigned char) c)) {
+            if (in_word) {
+                args.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (in_word) {
+        args.push_back(word);
+    }
+    return quote == '\0';
+}
+
+
+/**
+ * Description: writes all of buf to a file descriptor, retrying on partial
+ * writes and interrupts
+ * @return false if the write failed
+ */
+bool tm_utils::write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/**
+ * Description: reads exactly len bytes from a file descriptor
+ * @return false if the read failed or the other end closed it first
+ */
+bool tm_utils::read_all(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+tm_utils::ClientTerminal tm_utils::client_term;
+
+
+tm_utils::LineRenderer::LineRenderer() : is_tty_(isatty(STDOUT_FILENO)) {
+    this->resize();
+}
+
+
+/**
+ * Description: reads the width of the terminal again, and redraws the whole
+ * line on the next frame, called when it is resized
+ */
+void tm_utils::LineRenderer::resize() {
+    this->width_ = num_cols();
+    this->redraw_ = true;
+}
+
+
+// Appends the UTF-8 encoding of a code point below U+10000 to a string
+static void append_utf8(std::string &out, uint32_t c) {
+    if (c < 0x80) {
+        out += (char) c;
+    } else if (c < 0x800) {
+        out += (char) (0xC0 | (c >> 6));
+        out += (char) (0x80 | (c & 0x3F));
+    } else {
+        out += (char) (0xE0 | (c >> 12));
+        out += (char) (0x80 | ((c >> 6) & 0x3F));
+        out += (char) (0x80 | (c & 0x3F));
+    }
+}
+
+
+/**
+ * Description: writes the frame composed since begin, or only the columns
+ * that differ from the previous frame on a terminal
+ */
+void tm_utils::LineRenderer::end() {
+    size_t first = 0;
+    size_t last = this->cur_.size();
+    if (this->is_tty_ && !this->redraw_) {
+        while (first < last && first < this->prev_.size() &&
+               this->cur_[first] == this->prev_[first]) {
+            ++first;
+        }
+        if (this->cur_.size() == this->prev_.size()) {
+            while (last > first && this->cur_[last - 1] == this->prev_[last - 1]) {
+                --last;
+            }
+            if (first == last) {
+                return;
+            }
+        }
+    }
+
+    // The cursor is moved to the first column that changed
+    this->out_.clear();
+    if (this->is_tty_) {
+        this->out_ += "\r";
+        if (first > 0) {
+            this->out_ += "\033[" + std::to_string(first) + "C";
+        }
+    }
+    for (size_t i = first; i < last; ++i) {
+        append_utf8(this->out_, this->cur_[i]);
+    }
+    if (!this->is_tty_) {
+        this->out_ += '\n';
+    } else if (this->redraw_ || this->cur_.size() < this->prev_.size()) {
+        this->out_ += "\033[K";
+    }
+
+    // Anything buffered by std::cout goes first, to keep the output in order
+    std::cout.flush();
+    write_all(STDOUT_FILENO, this->out_.data(), this->out_.size());
+    this->prev_.swap(this->cur_);
+    this->redraw_ = false;
+}
+
+
+/**
+ * Description: moves to the next line, so that other output doesn't
+ * overwrite the last frame, the next frame is drawn on a new line
+ */
+void tm_utils::LineRenderer::finish() {
+    if (this->is_tty_ && !this->prev_.empty()) {
+        std::cout << std::endl;
+    }
+    this->prev_.clear();
+    this->redraw_ = true;
+}
+
+
+/**
+ * Description: displays text through the user's $PAGER (less by default)
+ * if stdout is a terminal, otherwise it is written to stdout at once
+ * @param[in] output: the text to display
+ */
+void tm_utils::page_output(const std::string &output) {
+#ifndef _WIN32
+    if (client_term.active) {
+        client_term.paged = client_term.is_tty;
+    } else if (isatty(STDOUT_FILENO)) {
+        const char *pager = getenv("PAGER");
+        if (pager == NULL || *pager == '\0') {
+            // -R so that the color codes are displayed rather than escaped
+            pager = "less -R";
+        }
+        FILE *pipe = popen(pager, "w");
+        if (pipe != NULL) {
+            // The pager can exit before reading everything, in which case
+            // the write fails instead of killing tm with SIGPIPE
+            auto prev_handler = signal(SIGPIPE, SIG_IGN);
+            fwrite(output.data(), 1, output.size(), pipe);
+            pclose(pipe);
+            signal(SIGPIPE, prev_handler);
+            return;
+        }
     }
 #endif
+    std::cout.write(output.data(), output.size());
+    std::cout.flush();
+}
+
+
+// The ratio between the bounds of a bucket, chosen so that the midpoint of
+// a bucket is within QUANTILE_ERR of every value in it
+static const double GAMMA = (1 + QUANTILE_ERR) / (1 - QUANTILE_ERR);
+static const double LOG_GAMMA = log(GAMMA);
+
+/**
+ * Description: adds a value to the statistics
+ * @param[in] val: the value to add
+ */
+void tm_math::RunningStats::add(double val) {
+    if (this->count_ == 0 || val < this->min_) {
+        this->min_ = val;
+    }
+    if (this->count_ == 0 || val > this->max_) {
+        this->max_ = val;
+    }
+    ++this->count_;
+    double delta = val - this->mean_;
+    this->mean_ += delta / this->count_;
+    this->m2_ += delta * (val - this->mean_);
+
+    if (val <= 0) {
+        ++this->non_positive_;
+        return;
+    }
+    int index = (int) ceil(log(val) / LOG_GAMMA);
+    if (this->buckets_.empty()) {
+        this->bucket_offset_ = index;
+    } else if (index < this->bucket_offset_) {
+        this->buckets_.insert(this->buckets_.begin(),
+                              this->bucket_offset_ - index, 0);
+        this->bucket_offset_ = index;
+    }
+    if (index - this->bucket_offset_ >= (int) this->buckets_.size()) {
+        this->buckets_.resize(index - this->bucket_offset_ + 1, 0);
+    }
+    ++this->buckets_[index - this->bucket_offset_];
+}
+
+
+/**
+ * Description: returns the population variance of the values
+ */
+double tm_math::RunningStats::variance() const {
+    return this->count_ == 0 ? 0.0 : this->m2_ / this->count_;
+}
+
+
+/**
+ * Description: returns the population standard deviation of the values
+ */
+double tm_math::RunningStats::standard_dev() const {
+    return sqrt(this->variance());
+}
+
+
+/**
+ * Description: estimates a quantile of the values, values that are 0 or
+ * negative are estimated as the minimum
+ * @param[in] q: the quantile to estimate, from 0 to 1, so 0.5 is the median
+ * @return the estimate, or 0 if no values were added
+ */
+double tm_math::RunningStats::quantile(double q) const {
+    if (this->count_ == 0) {
+        return 0.0;
+    }
+    // The nearest rank, the smallest value that at least q of the values
+    // are less than or equal to
+    long long rank = std::max((long long) ceil(q * this->count_) - 1, 0LL);
+    if (rank < this->non_positive_) {
+        return this->min_;
+    }
+    long long seen = this->non_positive_;
+    for (size_t i = 0; i < this->buckets_.size(); ++i) {
+        seen += this->buckets_[i];
+        if (seen > rank) {
+            double estimate = 2 * pow(GAMMA, (int) i + this->bucket_offset_)
+                / (GAMMA + 1);
+            return std::min(std::max(estimate, this->min_), this->max_);
+        }
+    }
+    return this->max_;
 }